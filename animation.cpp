@@ -0,0 +1,421 @@
+//
+//  animation.cpp
+//  
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <glm/gtx/quaternion.hpp>
+#include "animation.hpp"
+#include "encoder.hpp"
+#include "reproject.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+// Tiles handed out to the render threads
+static const int animationTileSize = 32;
+// Frames whose tiles can be rendered at the same time; each has its own copy of the scene
+static const int framesInFlight = 2;
+// Finished frames waiting for an encoder thread
+static const size_t maxPendingImages = 2;
+
+static bool parseVector( const std::string &value, vec3 &v ) {
+    return sscanf(value.c_str(), "%f,%f,%f", &v.x, &v.y, &v.z) == 3;
+}
+
+// Splits "key=value" into its parts; false if there is no =
+static bool splitKey( const std::string &token, std::string &key, std::string &value ) {
+    size_t equals = token.find('=');
+    if (equals == std::string::npos) { return false; }
+    key = token.substr(0, equals);
+    value = token.substr(equals + 1);
+    return true;
+}
+
+template <class Key>
+static bool byFrame( const Key &a, const Key &b ) {
+    return a.frame < b.frame;
+}
+
+// The keys on either side of frame and how far frame is between them
+template <class Key>
+static void bracket( const std::vector<Key> &keys, int frame, const Key* &a, const Key* &b, float &t ) {
+    size_t next = 0;
+    while (next < keys.size() && keys[next].frame <= frame) { next++; }
+    if (next == 0 || next == keys.size()) {
+        a = b = &keys[next == 0 ? 0 : keys.size() - 1];
+        t = 0;
+        return;
+    }
+    a = &keys[next - 1];
+    b = &keys[next];
+    t = (frame - a->frame) / (float)(b->frame - a->frame);
+}
+
+// Parses the keys of one camera, light or object line after its index
+static std::string parseKeyLine( std::istringstream &tokens, const std::string &type, int &frame, CameraKey &camera, LightKey &light, PoseKey &pose ) {
+    frame = -1;
+    std::string token, key, value;
+    while (tokens >> token) {
+        if (!splitKey(token, key, value)) { return "expected key=value, got " + token; }
+        bool valid = true;
+        if (key == "frame") {
+            frame = atoi(value.c_str());
+        } else if (type == "camera" && key == "position") {
+            valid = parseVector(value, camera.camera.position);
+        } else if (type == "camera" && key == "direction") {
+            valid = parseVector(value, camera.camera.direction) && glm::length(camera.camera.direction) > 0;
+        } else if (type == "camera" && key == "focal") {
+            camera.camera.focalLength = atof(value.c_str());
+        } else if (type == "light" && key == "position") {
+            valid = parseVector(value, light.light.position);
+        } else if (type == "light" && key == "intensity") {
+            valid = parseVector(value, light.light.intensity);
+        } else if ((type == "sphere" || type == "mesh") && key == "translate") {
+            valid = parseVector(value, pose.pose.translate);
+        } else if ((type == "sphere" || type == "mesh") && key == "rotate") {
+            vec3 axis;
+            float degrees;
+            valid = sscanf(value.c_str(), "%f,%f,%f,%f", &axis.x, &axis.y, &axis.z, &degrees) == 4 && glm::length(axis) > 0;
+            if (valid) { pose.pose.rotation = glm::angleAxis(glm::radians(degrees), glm::normalize(axis)); }
+        } else if ((type == "sphere" || type == "mesh") && key == "scale") {
+            pose.pose.scale = atof(value.c_str());
+        } else if ((type == "sphere" || type == "mesh") && key == "pivot") {
+            valid = parseVector(value, pose.pose.pivot);
+        } else {
+            return "unknown " + type + " key " + key;
+        }
+        if (!valid) { return "bad value for " + key + ": " + value; }
+    }
+    if (frame < 0) { return type + " key needs frame=N"; }
+    return "";
+}
+
+std::string Animation::load( const char* filename, const Scene &scene ) {
+    std::ifstream file(filename);
+    if (!file) { return "could not read " + std::string(filename); }
+    firstFrame = lastFrame = -1;
+    cameraKeys.clear();
+    lights.clear();
+    objects.clear();
+    
+    std::string line;
+    bool haveJob = false;
+    for (int lineNumber = 1; std::getline(file, line); lineNumber++) {
+        if (!line.empty() && line[line.size() - 1] == '\r') { line.erase(line.size() - 1); }
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] == '#') { continue; }
+        
+        std::ostringstream where;
+        where << filename << ":" << lineNumber << ": ";
+        std::istringstream tokens(line);
+        std::string type;
+        tokens >> type;
+        
+        if (type == "animation") {
+            // Everything but the frame range is a render job
+            std::string token, key, value, rest;
+            while (tokens >> token) {
+                if (splitKey(token, key, value) && key == "frames") {
+                    if (sscanf(value.c_str(), "%d-%d", &firstFrame, &lastFrame) != 2 || firstFrame < 0 || lastFrame < firstFrame) {
+                        return where.str() + "frames needs a range A-B";
+                    }
+                } else {
+                    rest += token + " ";
+                }
+            }
+            std::string error = parseRenderJob(rest, job);
+            if (!error.empty()) { return where.str() + error; }
+            if (job.output.find('#') == std::string::npos) { return where.str() + "output needs a run of # for the frame number"; }
+            if (job.deadlineMs > 0) { return where.str() + "deadline is for single renders and server jobs"; }
+            haveJob = true;
+            continue;
+        }
+        
+        int index = -1;
+        if (type == "light" || type == "sphere" || type == "mesh") {
+            int count = type == "light" ? scene.lights.size() : type == "sphere" ? scene.spheres.size() : scene.meshes.size();
+            if (!(tokens >> index) || index < 0 || index >= count) {
+                return where.str() + type + " needs the index of one of the scene's " + (type == "mesh" ? "meshes" : type + "s");
+            }
+        } else if (type != "camera") {
+            return where.str() + "unknown statement " + type;
+        }
+        
+        // Keys start from the scene's own values and an identity transform
+        int frame;
+        CameraKey cameraKey;
+        cameraKey.camera = scene.cam;
+        LightKey lightKey;
+        if (type == "light") { lightKey.light = scene.lights[index]; }
+        PoseKey poseKey;
+        poseKey.pose.translate = vec3(0);
+        poseKey.pose.rotation = glm::quat();
+        poseKey.pose.scale = 1;
+        poseKey.pose.pivot = vec3(0);
+        std::string error = parseKeyLine(tokens, type, frame, cameraKey, lightKey, poseKey);
+        if (!error.empty()) { return where.str() + error; }
+        
+        if (type == "camera") {
+            cameraKey.frame = frame;
+            cameraKeys.push_back(cameraKey);
+        } else if (type == "light") {
+            size_t track = 0;
+            while (track < lights.size() && lights[track].index != index) { track++; }
+            if (track == lights.size()) {
+                lights.push_back(LightTrack());
+                lights[track].index = index;
+            }
+            lightKey.frame = frame;
+            lights[track].keys.push_back(lightKey);
+        } else {
+            bool mesh = type == "mesh";
+            size_t track = 0;
+            while (track < objects.size() && (objects[track].mesh != mesh || objects[track].index != index)) { track++; }
+            if (track == objects.size()) {
+                ObjectTrack object;
+                object.mesh = mesh;
+                object.index = index;
+                object.restPosition = vec3(0);
+                object.restRadius = 0;
+                if (mesh) {
+                    for (int v = 0; v < 3; v++) {
+                        vec3 vertex = scene.meshes[index].getVertex(v);
+                        for (int c = 0; c < 3; c++) { object.restVertices[v*3 + c] = vertex[c]; }
+                    }
+                } else {
+                    object.restPosition = scene.spheres[index].getPosition();
+                    object.restRadius = scene.spheres[index].getRadius();
+                }
+                objects.push_back(object);
+            }
+            poseKey.frame = frame;
+            objects[track].keys.push_back(poseKey);
+        }
+    }
+    if (!haveJob) { return std::string(filename) + ": missing the animation line"; }
+    
+    // A camera on the animation line stands still unless the camera is keyed
+    if (cameraKeys.empty() && job.hasCamera) {
+        CameraKey key;
+        key.frame = firstFrame;
+        key.camera = job.camera;
+        cameraKeys.push_back(key);
+    }
+    std::stable_sort(cameraKeys.begin(), cameraKeys.end(), byFrame<CameraKey>);
+    for (size_t i = 0; i < lights.size(); i++) {
+        std::stable_sort(lights[i].keys.begin(), lights[i].keys.end(), byFrame<LightKey>);
+    }
+    for (size_t i = 0; i < objects.size(); i++) {
+        std::stable_sort(objects[i].keys.begin(), objects[i].keys.end(), byFrame<PoseKey>);
+    }
+    return "";
+}
+
+void Animation::apply( Scene &scene, int frame ) const {
+    if (!cameraKeys.empty()) {
+        const CameraKey *a, *b;
+        float t;
+        bracket(cameraKeys, frame, a, b, t);
+        vec3 from = glm::normalize(a->camera.direction);
+        vec3 to = glm::normalize(b->camera.direction);
+        scene.cam.position = glm::mix(a->camera.position, b->camera.position, t);
+        scene.cam.direction = glm::slerp(glm::quat(), glm::rotation(from, to), t) * from;
+        scene.cam.focalLength = glm::mix(a->camera.focalLength, b->camera.focalLength, t);
+    }
+    
+    for (size_t i = 0; i < lights.size(); i++) {
+        const LightKey *a, *b;
+        float t;
+        bracket(lights[i].keys, frame, a, b, t);
+        Light &light = scene.lights[lights[i].index];
+        light.position = glm::mix(a->light.position, b->light.position, t);
+        light.intensity = glm::mix(a->light.intensity, b->light.intensity, t);
+    }
+    
+    for (size_t i = 0; i < objects.size(); i++) {
+        const ObjectTrack &object = objects[i];
+        const PoseKey *a, *b;
+        float t;
+        bracket(object.keys, frame, a, b, t);
+        vec3 translate = glm::mix(a->pose.translate, b->pose.translate, t);
+        glm::quat rotation = glm::slerp(a->pose.rotation, b->pose.rotation, t);
+        float scale = glm::mix(a->pose.scale, b->pose.scale, t);
+        vec3 pivot = glm::mix(a->pose.pivot, b->pose.pivot, t);
+        
+        if (object.mesh) {
+            float vertices[9];
+            for (int v = 0; v < 3; v++) {
+                vec3 rest(object.restVertices[v*3], object.restVertices[v*3 + 1], object.restVertices[v*3 + 2]);
+                vec3 moved = pivot + translate + rotation * ((rest - pivot) * scale);
+                for (int c = 0; c < 3; c++) { vertices[v*3 + c] = moved[c]; }
+            }
+            scene.meshes[object.index].setVertices(vertices);
+        } else {
+            vec3 moved = pivot + translate + rotation * ((object.restPosition - pivot) * scale);
+            scene.spheres[object.index].setShape(moved, object.restRadius * scale);
+        }
+    }
+}
+
+std::string Animation::frameFilename( int frame ) const {
+    std::string name = job.output;
+    size_t start = name.find('#');
+    size_t end = name.find_first_not_of('#', start);
+    if (end == std::string::npos) { end = name.size(); }
+    char number[32];
+    snprintf(number, sizeof(number), "%0*d", (int)(end - start), frame);
+    return name.replace(start, end - start, number);
+}
+
+// A copy of the scene and the frame it currently shows
+struct FrameSlot {
+    Scene scene;
+    int frame;
+    int remainingTiles;
+    int reusedPixels;
+    std::shared_ptr<Framebuffer> framebuffer;
+    std::chrono::steady_clock::time_point started;
+};
+
+int runAnimation( const Animation &animation, const Scene &scene, int maxDepth, int threads, int encodeThreads, int pngCompression, float reprojectDegrees, bool writeMasks ) {
+    const RenderJob &job = animation.job;
+    RenderSettings settings;
+    settings.width = job.width;
+    settings.height = job.height;
+    settings.samplesPerPixel = job.samplesPerPixel;
+    settings.seed = job.seed;
+    settings.maxDepth = job.maxDepth > 0 ? job.maxDepth : maxDepth;
+    
+    int frames = animation.lastFrame - animation.firstFrame + 1;
+    int tilesX = (settings.width + animationTileSize - 1) / animationTileSize;
+    int tilesY = (settings.height + animationTileSize - 1) / animationTileSize;
+    int tilesPerFrame = tilesX * tilesY;
+    long long totalTiles = (long long)frames * tilesPerFrame;
+    if (threads <= 0) { threads = std::max(1u, std::thread::hardware_concurrency()); }
+    std::cerr << "Rendering frames " << animation.firstFrame << "-" << animation.lastFrame << " on " << threads << " threads" << std::endl;
+    
+    // Frame n (counting from 0) renders in slot n % inFlight once the frame
+    // before it in that slot is done. Tiles are handed out in frame order, so
+    // a thread only waits when every slot is busy. Reprojection needs the
+    // previous frame finished, so it renders one frame at a time
+    std::unique_ptr<ReprojectionCache> cache;
+    if (reprojectDegrees >= 0) { cache.reset(new ReprojectionCache(reprojectDegrees)); }
+    int inFlight = cache ? 1 : framesInFlight;
+    FrameSlot slots[framesInFlight];
+    for (int i = 0; i < inFlight; i++) {
+        slots[i].scene = scene;
+        slots[i].frame = i - inFlight;
+        slots[i].remainingTiles = 0;
+    }
+    long long reusedPixels = 0;
+    std::mutex mutex;
+    std::condition_variable changed;
+    long long nextTile = 0;
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ImageEncoder encoder(std::max(encodeThreads, 1), maxPendingImages);
+    {
+        STAT_TIMER(STAT_RENDER_LOOP);
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; i++) {
+            workers.push_back(std::thread([&]() {
+                if (traceEnabled) { setTraceThreadName("render"); }
+                while (true) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if (nextTile == totalTiles) { return; }
+                    long long tile = nextTile++;
+                    int frame = tile / tilesPerFrame;
+                    int index = tile % tilesPerFrame;
+                    FrameSlot &slot = slots[frame % inFlight];
+                    if (index == 0) {
+                        changed.wait(lock, [&]() { return slot.frame == frame - inFlight && slot.remainingTiles == 0; });
+                        animation.apply(slot.scene, animation.firstFrame + frame);
+                        slot.frame = frame;
+                        slot.remainingTiles = tilesPerFrame;
+                        slot.framebuffer.reset(new Framebuffer(settings.width, settings.height));
+                        slot.started = std::chrono::steady_clock::now();
+                        slot.reusedPixels = cache ? cache->reproject(slot.scene, settings, *slot.framebuffer) : 0;
+                        changed.notify_all();
+                    } else {
+                        changed.wait(lock, [&]() { return slot.frame == frame; });
+                    }
+                    lock.unlock();
+                    
+                    int tx = index % tilesX;
+                    int ty = index / tilesX;
+                    int x0 = tx*animationTileSize;
+                    int y0 = ty*animationTileSize;
+                    int w = std::min(animationTileSize, settings.width - x0);
+                    int h = std::min(animationTileSize, settings.height - y0);
+                    if (cache) {
+                        // Only the pixels reprojection could not fill are traced
+                        TraceScope trace("tile", tx, ty);
+                        for (int y = y0; y < y0 + h; y++) {
+                            for (int x = x0; x < x0 + w; x++) {
+                                if (cache->reused(x, y)) { continue; }
+                                AOVSample hit;
+                                vec3 color = renderPixel(slot.scene, settings, x, y, &hit);
+                                slot.framebuffer->set(x, y, color);
+                                cache->record(x, y, color, hit);
+                            }
+                        }
+                    } else {
+                        TraceScope trace("tile", tx, ty);
+                        float* pixels = slot.framebuffer->getData() + ((size_t)y0*settings.width + x0)*3;
+                        renderPixels(slot.scene, settings, x0, y0, w, h, pixels, (size_t)settings.width*3);
+                    }
+                    
+                    lock.lock();
+                    if (--slot.remainingTiles > 0) { continue; }
+                    std::shared_ptr<Framebuffer> framebuffer = slot.framebuffer;
+                    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - slot.started;
+                    slot.framebuffer.reset();
+                    std::shared_ptr<Framebuffer> mask;
+                    if (cache && writeMasks) {
+                        mask.reset(new Framebuffer());
+                        cache->confidenceMask(*mask);
+                    }
+                    if (cache) { cache->commit(slot.scene); }
+                    // The slot may start the next frame as soon as the lock is released
+                    int frameReused = slot.reusedPixels;
+                    reusedPixels += frameReused;
+                    changed.notify_all();
+                    lock.unlock();
+                    
+                    int number = animation.firstFrame + frame;
+                    std::string filename = animation.frameFilename(number);
+                    if (cache) {
+                        fprintf(stderr, "Frame %d rendered in %.3f ms, %.1f%% of camera rays saved by reprojection\n", number, elapsed.count(),
+                                100.0 * frameReused / (settings.width * settings.height));
+                    } else {
+                        fprintf(stderr, "Frame %d rendered in %.3f ms\n", number, elapsed.count());
+                    }
+                    encoder.submit(filename, [framebuffer, filename, pngCompression]() { return saveImage(*framebuffer, filename, pngCompression); });
+                    if (mask) {
+                        std::string maskFilename = filename.substr(0, filename.rfind('.')) + ".mask.pfm";
+                        encoder.submit(maskFilename, [mask, maskFilename]() { return mask->savePFM(maskFilename.c_str()); });
+                    }
+                }
+            }));
+        }
+        for (size_t i = 0; i < workers.size(); i++) { workers[i].join(); }
+    }
+    int failures = encoder.finish();
+    
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    fprintf(stderr, "Rendered %d frames in %.3f s (%.2f frames/s)\n", frames, seconds.count(), frames / seconds.count());
+    if (cache) {
+        fprintf(stderr, "Reprojection saved %.1f%% of camera rays\n", 100.0 * reusedPixels / ((double)frames * settings.width * settings.height));
+    }
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,100 @@
+//
+//  animation.hpp
+//  
+//
+
+#ifndef animation_hpp
+#define animation_hpp
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "render.hpp"
+#include "jobs.hpp"
+
+// Keyframed camera, lights and objects over a range of frames, read from an
+// animation file with one statement per line:
+//   animation frames=A-B output=NAME_####.png [width= height= spp= seed= depth= camera=]
+//   camera frame=N [position=X,Y,Z] [direction=X,Y,Z] [focal=F]
+//   light I frame=N [position=X,Y,Z] [intensity=R,G,B]
+//   sphere I frame=N [translate=X,Y,Z] [rotate=AX,AY,AZ,DEGREES] [scale=S] [pivot=X,Y,Z]
+//   mesh I frame=N   (same keys as sphere)
+// The animation line takes the keys of a render job (see jobs.hpp) plus the
+// frame range; the run of # in output is replaced by the zero padded frame
+// number. I indexes the scene's lights, spheres or meshes. Values missing from
+// a key are the scene's own (rest) values, or no transform for objects
+// Between keys positions, colours and sizes are interpolated linearly, and
+// directions and rotations along the shorter arc; before the first and after
+// the last key the nearest key holds
+
+// Object transform: scale and rotate about pivot, then translate
+struct Pose {
+    vec3 translate;
+    glm::quat rotation;
+    float scale;
+    vec3 pivot;
+};
+
+struct CameraKey {
+    int frame;
+    Camera camera;
+};
+
+struct LightKey {
+    int frame;
+    Light light;
+};
+
+struct PoseKey {
+    int frame;
+    Pose pose;
+};
+
+struct LightTrack {
+    int index;
+    std::vector<LightKey> keys;
+};
+
+// The pose is applied to the object as it was when the file was loaded
+struct ObjectTrack {
+    bool mesh;
+    int index;
+    vec3 restPosition;
+    float restRadius;
+    float restVertices[9];
+    std::vector<PoseKey> keys;
+};
+
+class Animation {
+public:
+    int firstFrame;
+    int lastFrame;
+    // Image size, samples and output pattern
+    RenderJob job;
+    std::vector<CameraKey> cameraKeys;
+    std::vector<LightTrack> lights;
+    std::vector<ObjectTrack> objects;
+
+    // Reads an animation of scene; returns an error message, or an empty
+    // string on success
+    std::string load(const char* filename, const Scene &scene);
+    // Moves the animated camera, lights and objects of scene to frame. Only
+    // those are written, so a scene copy can be stepped from frame to frame
+    void apply(Scene &scene, int frame) const;
+    std::string frameFilename(int frame) const;
+};
+
+// Renders the animation's frames against copies of scene, which stays as it
+// is. threads threads (0 for one per core) share the tiles of up to two
+// frames, so cores that finish one frame start on the next; finished frames
+// are written by encodeThreads threads with pngCompression (see
+// Framebuffer::savePNG). Frames without a depth use maxDepth
+// With reprojectDegrees >= 0 each frame reuses what it can of the previous
+// one (see reproject.hpp) and only traces the rest; frames then render one
+// at a time. writeMasks also writes each frame's confidence mask next to it
+// as <name>.mask.pfm
+// Returns the process exit status
+int runAnimation( const Animation &animation, const Scene &scene, int maxDepth, int threads, int encodeThreads, int pngCompression, float reprojectDegrees, bool writeMasks );
+
+#endif /* animation_hpp */
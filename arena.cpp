@@ -0,0 +1,80 @@
+//
+//  arena.cpp
+//  
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <new>
+#include "arena.hpp"
+#include "stats.hpp"
+
+Arena::Arena(size_t size) : blockSize(size), current(0), offset(0), inUse(0), peak(0), reserved(0) {}
+
+Arena::~Arena() {
+    for (size_t i = 0; i < blocks.size(); i++) { free(blocks[i].data); }
+}
+
+void* Arena::allocate(size_t bytes, size_t alignment) {
+    STAT_COUNT(STAT_ARENA_ALLOCATIONS);
+    STAT_ADD(STAT_ARENA_BYTES, bytes);
+    
+    // Move on through the blocks already held until one has room, then take a new one
+    while (true) {
+        if (current < blocks.size()) {
+            uintptr_t base = (uintptr_t)blocks[current].data;
+            size_t start = ((base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+            if (start + bytes <= blocks[current].size) {
+                offset = start + bytes;
+                inUse += bytes;
+                if (inUse > peak) { peak = inUse; }
+                return blocks[current].data + start;
+            }
+            if (current + 1 < blocks.size()) {
+                current++;
+                offset = 0;
+                continue;
+            }
+        }
+        
+        Block block;
+        block.size = bytes + alignment > blockSize ? bytes + alignment : blockSize;
+        block.data = (unsigned char*)malloc(block.size);
+        if (block.data == NULL) { throw std::bad_alloc(); }
+        STAT_ADD(STAT_ARENA_HEAP_BYTES, block.size);
+        reserved += block.size;
+        blocks.push_back(block);
+        current = blocks.size() - 1;
+        offset = 0;
+    }
+}
+
+Arena::Mark Arena::mark() const {
+    Mark m = { current, offset, inUse };
+    return m;
+}
+
+void Arena::rewind(const Mark &m) {
+    STAT_COUNT(STAT_ARENA_REWINDS);
+#ifdef ARENA_DEBUG
+    for (size_t i = m.block; i <= current && i < blocks.size(); i++) {
+        size_t start = i == m.block ? m.offset : 0;
+        size_t end = i == current ? offset : blocks[i].size;
+        if (end > start) { memset(blocks[i].data + start, 0xff, end - start); }
+    }
+#endif
+    current = m.block;
+    offset = m.offset;
+    inUse = m.inUse;
+}
+
+void Arena::reset() {
+    Mark start = { 0, 0, 0 };
+    rewind(start);
+}
+
+Arena& threadArena() {
+    static thread_local Arena arena;
+    return arena;
+}
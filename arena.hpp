@@ -0,0 +1,108 @@
+//
+//  arena.hpp
+//  
+//
+
+#ifndef arena_hpp
+#define arena_hpp
+
+#include <stddef.h>
+#include <vector>
+
+// Scratch memory for data that lives for one tile or one frame
+// An arena hands out memory by bumping an offset through blocks it keeps
+// between uses, so after the first tile or frame allocating costs a few
+// instructions and no heap calls. Nothing is freed on its own: mark() and
+// rewind() (or an ArenaScope) give back everything allocated since the mark,
+// and reset() gives back everything. Destructors are never run, so only
+// trivially destructible data belongs in an arena
+// Building with -DARENA_DEBUG (make ARENA_DEBUG=1) fills memory with 0xff
+// bytes as it is given back, which reads as NaN floats and wild pointers,
+// so anything still using it after its tile or frame shows up quickly
+
+static const size_t defaultArenaBlockSize = 256 * 1024;
+
+class Arena {
+    struct Block {
+        unsigned char* data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t blockSize;
+    // Block being bumped through and the offset of its free space
+    size_t current;
+    size_t offset;
+    size_t inUse;
+    size_t peak;
+    size_t reserved;
+
+public:
+    struct Mark {
+        size_t block;
+        size_t offset;
+        size_t inUse;
+    };
+    
+    explicit Arena(size_t blockSize = defaultArenaBlockSize);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    
+    void* allocate(size_t bytes, size_t alignment = alignof(max_align_t));
+    // Uninitialised room for count values of T
+    template <class T>
+    T* allocateArray(size_t count) {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+    
+    Mark mark() const;
+    // Gives back everything allocated since mark was taken
+    void rewind(const Mark &mark);
+    void reset();
+    
+    // Bytes handed out and not given back, the most there have been, and the
+    // bytes held in blocks
+    size_t bytesInUse() const { return inUse; }
+    size_t peakBytes() const { return peak; }
+    size_t reservedBytes() const { return reserved; }
+};
+
+// The calling thread's arena, for scratch data that does not leave the
+// thread's current tile or frame; take it in an ArenaScope
+Arena& threadArena();
+
+// Gives back everything allocated from an arena during its lifetime
+// Scopes nest: a frame can hold one while each of its tiles holds another
+class ArenaScope {
+    Arena &arena;
+    Arena::Mark start;
+
+public:
+    explicit ArenaScope(Arena &a) : arena(a), start(a.mark()) {}
+    ~ArenaScope() { arena.rewind(start); }
+};
+
+// Lets standard containers grow in an arena; growing leaves the old storage
+// behind until the arena is rewound, so reserve() when the size is known
+template <class T>
+struct ArenaAllocator {
+    typedef T value_type;
+    Arena* arena;
+    
+    explicit ArenaAllocator(Arena &a) : arena(&a) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+    
+    T* allocate(size_t count) { return arena->allocateArray<T>(count); }
+    void deallocate(T*, size_t) {}
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena == b.arena; }
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena != b.arena; }
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+#endif /* arena_hpp */
@@ -0,0 +1,95 @@
+//
+//  batch.cpp
+//  
+//
+
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <chrono>
+#include "batch.hpp"
+#include "jobs.hpp"
+#include "encoder.hpp"
+#include "stats.hpp"
+#include "tilepool.hpp"
+
+// Small tiles keep every thread busy until the end of each view
+static const int batchTileSize = 32;
+// Finished images waiting for an encoder thread; rendering waits once this
+// many are queued so a slow disk cannot make the batch hold every image in memory
+static const size_t maxPendingImages = 2;
+
+static double millisecondsSince( std::chrono::steady_clock::time_point start ) {
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+int runBatch( const char* viewsFile, Scene &scene, const char* sceneName, int maxDepth, int threads, int encodeThreads, int pngCompression ) {
+    std::ifstream file(viewsFile);
+    if (!file) {
+        std::cerr << "Could not read " << viewsFile << std::endl;
+        return 1;
+    }
+    
+    // Every view is checked before the first one renders
+    std::vector<RenderJob> views;
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); lineNumber++) {
+        if (!line.empty() && line[line.size() - 1] == '\r') { line.erase(line.size() - 1); }
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] == '#') { continue; }
+        RenderJob view;
+        std::string error = parseRenderJob(line, view);
+        if (error.empty() && view.output.empty()) { error = "output is required"; }
+        if (error.empty() && view.deadlineMs > 0) { error = "deadline is for single renders and server jobs"; }
+        if (error.empty() && !view.scene.empty() && view.scene != sceneName) {
+            error = "views render the loaded scene " + std::string(sceneName) + ", not " + view.scene;
+        }
+        if (!error.empty()) {
+            std::cerr << viewsFile << ":" << lineNumber << ": " << error << std::endl;
+            return 1;
+        }
+        views.push_back(view);
+    }
+    
+    if (threads <= 0) { threads = std::max(1u, std::thread::hardware_concurrency()); }
+    std::cerr << "Rendering " << views.size() << " views on " << threads << " threads" << std::endl;
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Camera sceneCamera = scene.cam;
+    ImageEncoder encoder(std::max(encodeThreads, 1), maxPendingImages);
+    {
+        STAT_TIMER(STAT_RENDER_LOOP);
+        TilePool pool(threads, batchTileSize);
+        for (size_t index = 0; index < views.size(); index++) {
+            RenderJob &view = views[index];
+            RenderSettings settings;
+            settings.width = view.width;
+            settings.height = view.height;
+            settings.samplesPerPixel = view.samplesPerPixel;
+            settings.seed = view.seed;
+            settings.maxDepth = view.maxDepth > 0 ? view.maxDepth : maxDepth;
+            // The pool is idle between views, so the camera can change here
+            scene.cam = view.hasCamera ? view.camera : sceneCamera;
+            
+            std::chrono::steady_clock::time_point renderStart = std::chrono::steady_clock::now();
+            std::shared_ptr<Framebuffer> framebuffer(new Framebuffer(view.width, view.height));
+            pool.render(scene, settings, *framebuffer);
+            fprintf(stderr, "View %d %dx%d spp %d rendered in %.3f ms\n", (int)index + 1, view.width, view.height,
+                    view.samplesPerPixel, millisecondsSince(renderStart));
+            std::string output = view.output;
+            encoder.submit(output, [framebuffer, output, pngCompression]() { return saveImage(*framebuffer, output, pngCompression); });
+        }
+    }
+    scene.cam = sceneCamera;
+    int failures = encoder.finish();
+    
+    double seconds = millisecondsSince(start) / 1000;
+    fprintf(stderr, "Rendered %d views in %.3f s (%.2f views/s)\n", (int)views.size(), seconds, views.size() / seconds);
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,23 @@
+//
+//  batch.hpp
+//  
+//
+
+#ifndef batch_hpp
+#define batch_hpp
+
+#include "render.hpp"
+
+// Renders many views of one loaded scene
+// The views file lists one view per line in the key=value form described in
+// jobs.hpp; output is required, scene may only name the loaded scene, and
+// blank lines and lines starting with # are skipped. Views without a camera
+// use the scene's. Views without a depth use maxDepth
+// Each view is split into tiles rendered by threads threads (0 for one per
+// core), and finished images are encoded and written by encodeThreads
+// threads while the next views render. PNGs are written with pngCompression
+// (see Framebuffer::savePNG). Returns the process exit status
+
+int runBatch( const char* viewsFile, Scene &scene, const char* sceneName, int maxDepth, int threads, int encodeThreads, int pngCompression );
+
+#endif /* batch_hpp */
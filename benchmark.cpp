@@ -0,0 +1,134 @@
+//
+//  benchmark.cpp
+//  
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "render.hpp"
+#include "stats.hpp"
+#include "scenes.hpp"
+
+// Standard procedural scenes rendered at several sizes
+// Results are printed as JSON so they can be tracked across versions
+// Ray counts come from the render statistics and read zero in a NO_STATS build
+
+static double perSecond( unsigned long long count, double seconds ) {
+    return seconds > 0 ? count / seconds : 0;
+}
+
+// Render the scene once and print its results as a JSON object
+void runBenchmark( RenderSettings &settings, int index, int size, int tileSize, bool first ) {
+    Scene scene;
+    settings.maxDepth = buildScene(scene, index, size);
+    Framebuffer framebuffer(settings.width, settings.height);
+    Framebuffer tile;
+    resetStats();
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int y0 = 0; y0 < settings.height; y0 += tileSize) {
+        for (int x0 = 0; x0 < settings.width; x0 += tileSize) {
+            renderTile(scene, settings, x0, y0, tileSize, tile, NULL);
+            framebuffer.setTile(x0, y0, tile);
+        }
+    }
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+    double seconds = wall.count();
+    
+    // ru_maxrss is the peak for the whole process, in kilobytes on Linux; each
+    // scene runs in a process of its own, so this is the peak of this scene
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    
+    RenderStats stats = mergeStats();
+    unsigned long long primary = stats.counters[STAT_PRIMARY_RAYS];
+    unsigned long long shadow = stats.counters[STAT_SHADOW_RAYS];
+    unsigned long long secondary = stats.counters[STAT_REFLECTION_RAYS];
+    unsigned long long total = primary + shadow + secondary;
+    printf("%s    {\"scene\": \"%s\", \"size\": \"%s\", \"width\": %d, \"height\": %d, \"spp\": %d, \"max_depth\": %d,\n",
+           first ? "" : ",\n", sceneNames[index], sizeNames[size], settings.width, settings.height, settings.samplesPerPixel, settings.maxDepth);
+    printf("     \"spheres\": %d, \"triangles\": %d, \"lights\": %d,\n", (int)scene.spheres.size(), (int)scene.meshes.size(), (int)scene.lights.size());
+    printf("     \"wall_seconds\": %.6f, \"peak_rss_kb\": %ld,\n", seconds, usage.ru_maxrss);
+    printf("     \"primary_rays\": %llu, \"shadow_rays\": %llu, \"secondary_rays\": %llu,\n", primary, shadow, secondary);
+    printf("     \"primary_mrays_per_s\": %.4f, \"shadow_mrays_per_s\": %.4f, \"secondary_mrays_per_s\": %.4f, \"total_mrays_per_s\": %.4f}",
+           perSecond(primary, seconds) / 1e6, perSecond(shadow, seconds) / 1e6,
+           perSecond(secondary, seconds) / 1e6, perSecond(total, seconds) / 1e6);
+    fflush(stdout);
+}
+
+static int findName( const char* name, const char* names[], int count ) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) { return i; }
+    }
+    return -1;
+}
+
+int main(int argc, char* argv[]) {
+    int onlyScene = -1;
+    // By default the large scenes are skipped; they take minutes without an acceleration structure
+    int firstSize = 0;
+    int lastSize = 1;
+    int tileSize = 64;
+    RenderSettings settings;
+    settings.width = 256;
+    settings.height = 256;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--scene") == 0 && i+1 < argc) {
+            onlyScene = findName(argv[++i], sceneNames, numScenes);
+            if (onlyScene < 0) {
+                std::cerr << "Unknown scene " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--size") == 0 && i+1 < argc) {
+            i++;
+            if (strcmp(argv[i], "all") == 0) {
+                firstSize = 0;
+                lastSize = numSizes - 1;
+                continue;
+            }
+            firstSize = lastSize = findName(argv[i], sizeNames, numSizes);
+            if (firstSize < 0) {
+                std::cerr << "Unknown size " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--width") == 0 && i+1 < argc) {
+            settings.width = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--height") == 0 && i+1 < argc) {
+            settings.height = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--spp") == 0 && i+1 < argc) {
+            settings.samplesPerPixel = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tile-size") == 0 && i+1 < argc) {
+            tileSize = atoi(argv[++i]);
+        }
+    }
+    
+    printf("{\"benchmark\": \"raytracer\", \"results\": [\n");
+    fflush(stdout);
+    bool first = true;
+    for (int scene = 0; scene < numScenes; scene++) {
+        for (int size = firstSize; size <= lastSize; size++) {
+            if (onlyScene >= 0 && scene != onlyScene) { continue; }
+            // A fresh process per scene, so its peak memory is not an earlier, larger scene's
+            pid_t child = fork();
+            if (child == 0) {
+                runBenchmark(settings, scene, size, tileSize, first);
+                _exit(0);
+            }
+            int status = 0;
+            if (child == -1 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                std::cerr << "Benchmark of " << sceneNames[scene] << "-" << sizeNames[size] << " failed" << std::endl;
+                return 1;
+            }
+            first = false;
+        }
+    }
+    printf("\n]}\n");
+}
@@ -0,0 +1,158 @@
+//
+//  capture.cpp
+//  
+//
+
+#include <iostream>
+#include <string.h>
+#include <stdint.h>
+#include <mutex>
+#include "capture.hpp"
+
+const char* rayTypeNames[NUM_RAY_TYPES] = { "primary", "shadow", "reflection" };
+
+static const char captureMagic[8] = { 'R','T','R','A','Y','S','0','1' };
+static const long rayCountOffset = 8 + 2 * sizeof(uint32_t);
+
+bool rayCaptureEnabled = false;
+
+// Each thread packs rays into its own buffer; full buffers are appended to
+// the file under the lock, so records from different threads never interleave
+static FILE* captureFile = NULL;
+static std::mutex captureMutex;
+static unsigned long long capturedRays = 0;
+static thread_local std::vector<unsigned char> threadBuffer;
+static const size_t flushBytes = 1 << 20;
+
+bool openRayCapture(const char *filename, std::vector<Sphere> &spheres, std::vector<Mesh> &meshes) {
+    captureFile = fopen(filename, "wb");
+    if (captureFile == NULL) { return false; }
+    
+    uint32_t counts[2] = { (uint32_t)spheres.size(), (uint32_t)meshes.size() };
+    uint64_t rays = 0;
+    fwrite(captureMagic, 1, sizeof(captureMagic), captureFile);
+    fwrite(counts, sizeof(uint32_t), 2, captureFile);
+    fwrite(&rays, sizeof(uint64_t), 1, captureFile);
+    
+    for (size_t i = 0; i < spheres.size(); i++) {
+        vec3 center = spheres[i].getPosition();
+        float sphere[4] = { center.x, center.y, center.z, spheres[i].getRadius() };
+        fwrite(sphere, sizeof(float), 4, captureFile);
+    }
+    for (size_t i = 0; i < meshes.size(); i++) {
+        float verts[9];
+        for (int v = 0; v < 3; v++) {
+            vec3 vertex = meshes[i].getVertex(v);
+            verts[v*3+0] = vertex.x;
+            verts[v*3+1] = vertex.y;
+            verts[v*3+2] = vertex.z;
+        }
+        fwrite(verts, sizeof(float), 9, captureFile);
+    }
+    
+    capturedRays = 0;
+    rayCaptureEnabled = true;
+    return !ferror(captureFile);
+}
+
+void captureRay(Ray ray, float minTime, float maxTime, RayType type) {
+    float values[8] = { ray.origin.x, ray.origin.y, ray.origin.z, ray.path.x, ray.path.y, ray.path.z, minTime, maxTime };
+    size_t size = threadBuffer.size();
+    threadBuffer.resize(size + capturedRayBytes);
+    memcpy(&threadBuffer[size], values, sizeof(values));
+    threadBuffer[size + sizeof(values)] = type;
+    
+    if (threadBuffer.size() >= flushBytes) {
+        flushRayCapture();
+    }
+}
+
+// Append the calling thread's buffered rays to the file
+void flushRayCapture() {
+    if (threadBuffer.empty()) { return; }
+    std::lock_guard<std::mutex> lock(captureMutex);
+    if (captureFile != NULL) {
+        fwrite(&threadBuffer[0], 1, threadBuffer.size(), captureFile);
+        capturedRays += threadBuffer.size() / capturedRayBytes;
+    }
+    threadBuffer.clear();
+}
+
+// Every rendering thread must have flushed before the capture is closed
+bool closeRayCapture() {
+    flushRayCapture();
+    rayCaptureEnabled = false;
+    if (captureFile == NULL) { return false; }
+    
+    uint64_t rays = capturedRays;
+    bool success = fseek(captureFile, rayCountOffset, SEEK_SET) == 0 && fwrite(&rays, sizeof(uint64_t), 1, captureFile) == 1;
+    success = fclose(captureFile) == 0 && success;
+    captureFile = NULL;
+    return success;
+}
+
+RayCaptureReader::RayCaptureReader() {
+    file = NULL;
+    numRays = 0;
+    raysRead = 0;
+}
+
+RayCaptureReader::~RayCaptureReader() {
+    if (file != NULL) { fclose(file); }
+}
+
+bool RayCaptureReader::open(const char *filename, std::vector<Sphere> &spheres, std::vector<Mesh> &meshes) {
+    file = fopen(filename, "rb");
+    if (file == NULL) { return false; }
+    
+    char magic[8];
+    uint32_t counts[2];
+    uint64_t rays;
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, captureMagic, sizeof(magic)) != 0 ||
+        fread(counts, sizeof(uint32_t), 2, file) != 2 || fread(&rays, sizeof(uint64_t), 1, file) != 1) {
+        return false;
+    }
+    numRays = rays;
+    raysRead = 0;
+    
+    // Materials are not captured; replays only intersect
+    spheres.clear();
+    meshes.clear();
+    for (uint32_t i = 0; i < counts[0]; i++) {
+        float sphere[4];
+        if (fread(sphere, sizeof(float), 4, file) != 4) { return false; }
+        spheres.push_back(Sphere(vec3(sphere[0], sphere[1], sphere[2]), sphere[3]));
+    }
+    for (uint32_t i = 0; i < counts[1]; i++) {
+        float verts[9];
+        if (fread(verts, sizeof(float), 9, file) != 9) { return false; }
+        meshes.push_back(Mesh(verts));
+    }
+    return true;
+}
+
+unsigned long long RayCaptureReader::getNumRays() {
+    return numRays;
+}
+
+int RayCaptureReader::read(std::vector<CapturedRay> &batch, int max) {
+    unsigned long long remaining = numRays - raysRead;
+    int count = remaining < (unsigned long long)max ? (int)remaining : max;
+    
+    std::vector<unsigned char> bytes((size_t)count * capturedRayBytes);
+    if (count > 0 && fread(&bytes[0], capturedRayBytes, count, file) != (size_t)count) { return -1; }
+    batch.resize(count);
+    for (int i = 0; i < count; i++) {
+        float values[8];
+        memcpy(values, &bytes[(size_t)i * capturedRayBytes], sizeof(values));
+        batch[i].ray.origin = vec3(values[0], values[1], values[2]);
+        batch[i].ray.path = vec3(values[3], values[4], values[5]);
+        batch[i].minTime = values[6];
+        batch[i].maxTime = values[7];
+        unsigned char type = bytes[(size_t)i * capturedRayBytes + sizeof(values)];
+        if (type >= NUM_RAY_TYPES) { return -1; }
+        batch[i].type = (RayType) type;
+    }
+    raysRead += count;
+    return count;
+}
@@ -0,0 +1,60 @@
+//
+//  capture.hpp
+//  
+//
+
+#ifndef capture_hpp
+#define capture_hpp
+
+#include <stdio.h>
+#include <vector>
+#include "geometry.hpp"
+
+// Recording of every ray traced in a frame, for offline traversal benchmarks
+//
+// File layout (little endian):
+//   header    "RTRAYS01", uint32 spheres, uint32 triangles, uint64 rays
+//   spheres   center xyz, radius (4 floats each)
+//   triangles vertices (9 floats each)
+//   rays      origin xyz, direction xyz, tmin, tmax (8 floats), type (1 byte)
+//
+// The scene geometry is stored with the rays so a replay needs nothing else
+
+enum RayType { RAY_PRIMARY, RAY_SHADOW, RAY_REFLECTION, NUM_RAY_TYPES };
+
+extern const char* rayTypeNames[NUM_RAY_TYPES];
+
+const int capturedRayBytes = 8 * sizeof(float) + 1;
+
+struct CapturedRay {
+    Ray ray;
+    float minTime;
+    float maxTime;
+    RayType type;
+};
+
+// Set while a capture is open; checked by the renderer before recording
+extern bool rayCaptureEnabled;
+
+bool openRayCapture(const char *filename, std::vector<Sphere> &spheres, std::vector<Mesh> &meshes);
+void captureRay(Ray ray, float minTime, float maxTime, RayType type);
+void flushRayCapture();
+bool closeRayCapture();
+
+// Reading side, used by the replay tool
+class RayCaptureReader {
+    FILE* file;
+    unsigned long long numRays;
+    unsigned long long raysRead;
+    
+public:
+    RayCaptureReader();
+    ~RayCaptureReader();
+    bool open(const char *filename, std::vector<Sphere> &spheres, std::vector<Mesh> &meshes);
+    unsigned long long getNumRays();
+    // Reads up to max rays into batch; returns the number read, 0 at the end,
+    // or -1 if the file is truncated or holds an unknown ray type
+    int read(std::vector<CapturedRay> &batch, int max);
+};
+
+#endif /* capture_hpp */
@@ -0,0 +1,115 @@
+//
+//  checkpoint.cpp
+//  
+//
+
+#include <iostream>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include "checkpoint.hpp"
+
+// File layout: header, per tile sample counts, then each buffer as
+// (width, height, channels, float data)
+struct CheckpointHeader {
+    char magic[8];
+    int width;
+    int height;
+    int tileSize;
+    int samplesPerPixel;
+    int maxDepth;
+    unsigned int seed;
+    unsigned int aovMask;
+    int outOfCore;
+    int numTiles;
+    int numBuffers;
+    uint64_t sceneHash;
+};
+
+static const char checkpointMagic[8] = { 'R','T','C','K','P','T','0','2' };
+
+// Written to a temporary file and renamed so a crash never leaves a torn checkpoint
+bool saveCheckpoint(const char *filename, RenderState &state, std::vector<Framebuffer*> &buffers) {
+    std::string tmpName = std::string(filename) + ".tmp";
+    FILE* file = fopen(tmpName.c_str(), "wb");
+    if (file == NULL) { return false; }
+    
+    CheckpointHeader header;
+    memcpy(header.magic, checkpointMagic, sizeof(header.magic));
+    header.width = state.width;
+    header.height = state.height;
+    header.tileSize = state.tileSize;
+    header.samplesPerPixel = state.samplesPerPixel;
+    header.maxDepth = state.maxDepth;
+    header.seed = state.seed;
+    header.aovMask = state.aovMask;
+    header.outOfCore = state.outOfCore;
+    header.numTiles = state.tileSamples.size();
+    header.numBuffers = buffers.size();
+    header.sceneHash = state.sceneHash;
+    
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+    success = success && fwrite(&state.tileSamples[0], sizeof(int), header.numTiles, file) == (size_t)header.numTiles;
+    for (size_t i = 0; i < buffers.size() && success; i++) {
+        success = buffers[i]->write(file);
+    }
+    
+    success = fflush(file) == 0 && fsync(fileno(file)) == 0 && success;
+    success = fclose(file) == 0 && success;
+    if (!success) {
+        remove(tmpName.c_str());
+        return false;
+    }
+    return rename(tmpName.c_str(), filename) == 0;
+}
+
+static bool readHeader(FILE* file, CheckpointHeader &header) {
+    return fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, checkpointMagic, sizeof(header.magic)) == 0;
+}
+
+bool loadCheckpoint(const char *filename, RenderState &state) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) { return false; }
+    
+    // The tile grid is sized from the header, so it must be consistent before it is trusted
+    CheckpointHeader header;
+    bool valid = readHeader(file, header) && header.width > 0 && header.height > 0 && header.tileSize > 0 && header.samplesPerPixel > 0;
+    if (valid) {
+        long long tilesX = (header.width + (long long)header.tileSize - 1) / header.tileSize;
+        long long tilesY = (header.height + (long long)header.tileSize - 1) / header.tileSize;
+        valid = header.numTiles == tilesX * tilesY;
+    }
+    if (!valid) {
+        fclose(file);
+        return false;
+    }
+    state.width = header.width;
+    state.height = header.height;
+    state.tileSize = header.tileSize;
+    state.samplesPerPixel = header.samplesPerPixel;
+    state.maxDepth = header.maxDepth;
+    state.seed = header.seed;
+    state.aovMask = header.aovMask;
+    state.outOfCore = header.outOfCore != 0;
+    state.sceneHash = header.sceneHash;
+    state.tileSamples.resize(header.numTiles);
+    
+    bool success = fread(&state.tileSamples[0], sizeof(int), header.numTiles, file) == (size_t)header.numTiles;
+    fclose(file);
+    return success;
+}
+
+// Buffers must be passed in the order they were saved
+bool loadCheckpointBuffers(const char *filename, std::vector<Framebuffer*> &buffers) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) { return false; }
+    
+    CheckpointHeader header;
+    bool success = readHeader(file, header) && header.numBuffers == (int)buffers.size();
+    success = success && fseek(file, sizeof(int) * header.numTiles, SEEK_CUR) == 0;
+    for (size_t i = 0; i < buffers.size() && success; i++) {
+        success = buffers[i]->read(file);
+    }
+    fclose(file);
+    return success;
+}
@@ -0,0 +1,38 @@
+//
+//  checkpoint.hpp
+//  
+//
+
+#ifndef checkpoint_hpp
+#define checkpoint_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include "framebuffer.hpp"
+
+// Progress of a render: enough to continue it exactly after an interruption
+// Camera samples are drawn from a counter based generator keyed on seed,
+// pixel and sample index, so the seed is the whole generator state
+struct RenderState {
+    int width;
+    int height;
+    int tileSize;
+    int samplesPerPixel;
+    int maxDepth;
+    unsigned int seed;
+    unsigned int aovMask;
+    bool outOfCore;
+    // Scene::hash() of the scene being rendered; a resume must match it
+    uint64_t sceneHash;
+    // Samples per pixel completed in each tile, row major
+    std::vector<int> tileSamples;
+};
+
+// The buffers are the accumulated beauty and AOV buffers, in a fixed order
+// Out of core renders keep their pixels in the tile file and pass no buffers
+bool saveCheckpoint(const char *filename, RenderState &state, std::vector<Framebuffer*> &buffers);
+bool loadCheckpoint(const char *filename, RenderState &state);
+bool loadCheckpointBuffers(const char *filename, std::vector<Framebuffer*> &buffers);
+
+#endif /* checkpoint_hpp */
@@ -0,0 +1,264 @@
+//
+//  compare.cpp
+//  
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "framebuffer.hpp"
+
+// Measures the quality cost and speedup of an approximate render mode
+// The raytracer is run once with the reference arguments and once with the
+// candidate arguments, both writing PFMs, and the candidate image is compared
+// against the reference. The exit status is 1 if it falls below the thresholds
+
+struct Quality {
+    double psnr;
+    double ssim;
+    double maxError;
+    double rmse;
+};
+
+// Errors are measured on the displayed 0-255 range, like the 8-bit PNG at
+// exposure 0, so differences hidden by clamping do not count
+static float displayed( float value ) {
+    return std::isfinite(value) ? glm::clamp(value, 0.0f, 255.0f) : 0;
+}
+
+// Separable Gaussian blur (11 taps, sigma 1.5) with clamped edges, as used by SSIM
+static void gaussianBlur( std::vector<double> &image, int width, int height ) {
+    static const int radius = 5;
+    double weights[2*radius + 1];
+    double sum = 0;
+    for (int i = -radius; i <= radius; i++) {
+        weights[i + radius] = exp(-(i*i) / (2 * 1.5 * 1.5));
+        sum += weights[i + radius];
+    }
+    for (int i = 0; i <= 2*radius; i++) { weights[i] /= sum; }
+    
+    std::vector<double> temp(image.size());
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            double value = 0;
+            for (int i = -radius; i <= radius; i++) {
+                value += weights[i + radius] * image[y*width + glm::clamp(x + i, 0, width - 1)];
+            }
+            temp[y*width + x] = value;
+        }
+    }
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            double value = 0;
+            for (int i = -radius; i <= radius; i++) {
+                value += weights[i + radius] * temp[glm::clamp(y + i, 0, height - 1)*width + x];
+            }
+            image[y*width + x] = value;
+        }
+    }
+}
+
+// Mean SSIM of one channel (Wang et al. 2004, K1 = 0.01, K2 = 0.03)
+static double channelSSIM( Framebuffer &reference, Framebuffer &candidate, int channel ) {
+    int width = reference.getWidth();
+    int height = reference.getHeight();
+    int pixels = width * height;
+    std::vector<double> a(pixels), b(pixels), aa(pixels), bb(pixels), ab(pixels);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int i = y*width + x;
+            a[i] = displayed(reference.get(x, y)[channel]);
+            b[i] = displayed(candidate.get(x, y)[channel]);
+            aa[i] = a[i] * a[i];
+            bb[i] = b[i] * b[i];
+            ab[i] = a[i] * b[i];
+        }
+    }
+    gaussianBlur(a, width, height);
+    gaussianBlur(b, width, height);
+    gaussianBlur(aa, width, height);
+    gaussianBlur(bb, width, height);
+    gaussianBlur(ab, width, height);
+    
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+    double total = 0;
+    for (int i = 0; i < pixels; i++) {
+        double varA = aa[i] - a[i]*a[i];
+        double varB = bb[i] - b[i]*b[i];
+        double covariance = ab[i] - a[i]*b[i];
+        total += ((2*a[i]*b[i] + c1) * (2*covariance + c2)) / ((a[i]*a[i] + b[i]*b[i] + c1) * (varA + varB + c2));
+    }
+    return total / pixels;
+}
+
+static Quality compareImages( Framebuffer &reference, Framebuffer &candidate ) {
+    Quality quality;
+    int channels = reference.getChannels();
+    double squaredError = 0;
+    quality.maxError = 0;
+    for (int y = 0; y < reference.getHeight(); y++) {
+        for (int x = 0; x < reference.getWidth(); x++) {
+            vec3 a = reference.get(x, y);
+            vec3 b = candidate.get(x, y);
+            for (int c = 0; c < channels; c++) {
+                double error = fabs(displayed(a[c]) - displayed(b[c]));
+                squaredError += error * error;
+                quality.maxError = std::max(quality.maxError, error);
+            }
+        }
+    }
+    quality.rmse = sqrt(squaredError / ((double)reference.getWidth() * reference.getHeight() * channels));
+    quality.psnr = quality.rmse > 0 ? 20 * log10(255 / quality.rmse) : INFINITY;
+    
+    quality.ssim = 0;
+    for (int c = 0; c < channels; c++) {
+        quality.ssim += channelSSIM(reference, candidate, c) / channels;
+    }
+    return quality;
+}
+
+// Runs the raytracer with the given arguments (split by the shell) writing a
+// PFM to pfmFile; seconds is the fastest wall time over the runs
+static bool render( const std::string &raytracer, const std::string &args, const std::string &pfmFile, int runs, double &seconds ) {
+    std::string command = raytracer + " " + args + " --no-png --pfm " + pfmFile;
+    seconds = INFINITY;
+    for (int run = 0; run < runs; run++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (system(command.c_str()) != 0) {
+            std::cerr << "Failed: " << command << std::endl;
+            return false;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        seconds = std::min(seconds, elapsed.count());
+    }
+    return true;
+}
+
+static std::string tempPFM() {
+    char name[] = "/tmp/compareXXXXXX.pfm";
+    int fd = mkstemps(name, 4);
+    if (fd == -1) { return ""; }
+    close(fd);
+    return name;
+}
+
+int main(int argc, char* argv[]) {
+    std::string raytracer = "./raytracer";
+    std::string referenceArgs = "";
+    const char* candidateArgs = NULL;
+    const char* referenceImage = NULL;
+    const char* candidateImage = NULL;
+    int runs = 1;
+    double minPSNR = 40;
+    double minSSIM = 0.99;
+    double maxError = -1;
+    bool json = false;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--raytracer") == 0 && i+1 < argc) {
+            raytracer = argv[++i];
+        } else if (strcmp(argv[i], "--reference") == 0 && i+1 < argc) {
+            referenceArgs = argv[++i];
+        } else if (strcmp(argv[i], "--candidate") == 0 && i+1 < argc) {
+            candidateArgs = argv[++i];
+        } else if (strcmp(argv[i], "--images") == 0 && i+2 < argc) {
+            referenceImage = argv[++i];
+            candidateImage = argv[++i];
+        } else if (strcmp(argv[i], "--runs") == 0 && i+1 < argc) {
+            runs = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--min-psnr") == 0 && i+1 < argc) {
+            minPSNR = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--min-ssim") == 0 && i+1 < argc) {
+            minSSIM = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-error") == 0 && i+1 < argc) {
+            maxError = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        }
+    }
+    if (candidateArgs == NULL && referenceImage == NULL) {
+        std::cerr << "Usage: compare --candidate ARGS [--reference ARGS] [--raytracer PATH] [--runs N]" << std::endl;
+        std::cerr << "       compare --images REFERENCE.pfm CANDIDATE.pfm" << std::endl;
+        std::cerr << "       [--min-psnr DB] [--min-ssim S] [--max-error E] [--json]" << std::endl;
+        return 1;
+    }
+    
+    // Render both configurations, unless two existing images were given
+    double referenceSeconds = 0, candidateSeconds = 0;
+    std::string referenceFile, candidateFile;
+    if (referenceImage != NULL) {
+        referenceFile = referenceImage;
+        candidateFile = candidateImage;
+    } else {
+        referenceFile = tempPFM();
+        candidateFile = tempPFM();
+        if (referenceFile.empty() || candidateFile.empty()) {
+            std::cerr << "Could not create temporary files" << std::endl;
+            return 1;
+        }
+        bool rendered = render(raytracer, referenceArgs, referenceFile, runs, referenceSeconds) &&
+                        render(raytracer, candidateArgs, candidateFile, runs, candidateSeconds);
+        if (!rendered) {
+            unlink(referenceFile.c_str());
+            unlink(candidateFile.c_str());
+            return 1;
+        }
+    }
+    
+    // PFMs hold the renderer's 0-255 scale divided by 255
+    Framebuffer reference, candidate;
+    bool loaded = reference.loadPFM(referenceFile.c_str(), 255) && candidate.loadPFM(candidateFile.c_str(), 255);
+    if (referenceImage == NULL) {
+        unlink(referenceFile.c_str());
+        unlink(candidateFile.c_str());
+    }
+    if (!loaded) {
+        std::cerr << "Could not read " << referenceFile << " or " << candidateFile << std::endl;
+        return 1;
+    }
+    if (reference.getWidth() != candidate.getWidth() || reference.getHeight() != candidate.getHeight() ||
+        reference.getChannels() != candidate.getChannels()) {
+        std::cerr << "The images have different sizes: " << reference.getWidth() << "x" << reference.getHeight() << " and "
+                  << candidate.getWidth() << "x" << candidate.getHeight() << std::endl;
+        return 1;
+    }
+    
+    Quality quality = compareImages(reference, candidate);
+    double speedup = candidateSeconds > 0 ? referenceSeconds / candidateSeconds : 0;
+    bool passed = quality.psnr >= minPSNR && quality.ssim >= minSSIM && (maxError < 0 || quality.maxError <= maxError);
+    
+    if (json) {
+        // JSON has no infinity, so identical images report a null PSNR
+        char psnr[32] = "null";
+        if (std::isfinite(quality.psnr)) { snprintf(psnr, sizeof(psnr), "%.4f", quality.psnr); }
+        printf("{\"psnr\": %s, \"ssim\": %.6f, \"max_error\": %.4f, \"rmse\": %.6f, ", psnr, quality.ssim, quality.maxError, quality.rmse);
+        if (referenceImage == NULL) {
+            printf("\"reference_seconds\": %.6f, \"candidate_seconds\": %.6f, \"speedup\": %.4f, ", referenceSeconds, candidateSeconds, speedup);
+        }
+        printf("\"passed\": %s}\n", passed ? "true" : "false");
+    } else {
+        if (referenceImage == NULL) {
+            printf("%-10s %10.4f s  %s\n", "reference", referenceSeconds, referenceArgs.c_str());
+            printf("%-10s %10.4f s  %s\n", "candidate", candidateSeconds, candidateArgs);
+            printf("%-10s %10.3fx\n", "speedup", speedup);
+        }
+        printf("%-10s %10.4f dB (min %g)\n", "psnr", quality.psnr, minPSNR);
+        printf("%-10s %10.6f    (min %g)\n", "ssim", quality.ssim, minSSIM);
+        if (maxError >= 0) {
+            printf("%-10s %10.4f    (max %g)\n", "max_error", quality.maxError, maxError);
+        } else {
+            printf("%-10s %10.4f\n", "max_error", quality.maxError);
+        }
+        printf("%-10s %10.4f\n", "rmse", quality.rmse);
+        printf("%s\n", passed ? "PASS" : "FAIL");
+    }
+    return passed ? 0 : 1;
+}
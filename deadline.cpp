@@ -0,0 +1,190 @@
+//
+//  deadline.cpp
+//  
+//
+
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include "deadline.hpp"
+#include "trace.hpp"
+#include "arena.hpp"
+
+static const int deadlineTileSize = 32;
+// Pixels per side of the blocks the preview pass traces one ray for
+static const int previewBlock = 8;
+// How much longer than predicted a tile is allowed to take
+static const double timeMargin = 1.5;
+
+typedef std::chrono::steady_clock Clock;
+
+struct DeadlineTile {
+    int x0, y0, width, height;
+    // Squared distance from the tile centre to the image centre
+    float centreDistance;
+    // Mean variance of its pixels' means, the noisiest first
+    float error;
+    int samples;
+};
+
+static bool byPriority( const DeadlineTile* a, const DeadlineTile* b ) {
+    if (a->error != b->error) { return a->error > b->error; }
+    return a->centreDistance < b->centreDistance;
+}
+
+// Runs work(i) for i in [0, count) on threads threads; work returns false
+// to stop every thread from taking more
+static void parallelFor( int threads, int count, const std::function<bool(int)> &work ) {
+    std::atomic<int> next(0);
+    std::atomic<bool> stopped(false);
+    auto run = [&]() {
+        for (int i = next++; i < count && !stopped; i = next++) {
+            if (!work(i)) { stopped = true; }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 1; i < std::min(threads, count); i++) {
+        workers.push_back(std::thread([&]() {
+            if (traceEnabled) { setTraceThreadName("render"); }
+            run();
+        }));
+    }
+    run();
+    for (size_t i = 0; i < workers.size(); i++) { workers[i].join(); }
+}
+
+static float luminance( vec3 color ) {
+    return 0.2126f*color.x + 0.7152f*color.y + 0.0722f*color.z;
+}
+
+DeadlineReport renderToDeadline( const Scene &scene, const RenderSettings &settings, Clock::time_point deadline, Framebuffer &image, int threads ) {
+    if (threads <= 0) { threads = std::max(1u, std::thread::hardware_concurrency()); }
+    int width = settings.width;
+    int height = settings.height;
+    image.resize(width, height);
+    
+    // Preview: one centre ray per block, spread over the block
+    Clock::time_point previewStart = Clock::now();
+    int blocksX = (width + previewBlock - 1) / previewBlock;
+    int blocksY = (height + previewBlock - 1) / previewBlock;
+    // Time the threads spent on preview rows, as the tiles count theirs below
+    std::atomic<long long> previewNanoseconds(0);
+    parallelFor(threads, blocksY, [&](int by) {
+        TRACE_SCOPE("preview");
+        Clock::time_point start = Clock::now();
+        int y0 = by*previewBlock;
+        int y1 = std::min(y0 + previewBlock, height);
+        for (int bx = 0; bx < blocksX; bx++) {
+            int x0 = bx*previewBlock;
+            int x1 = std::min(x0 + previewBlock, width);
+            vec3 color = raytrace(scene, settings, genCameraRay(scene, settings, (x0 + x1)/2, (y0 + y1)/2));
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) { image.set(x, y, color); }
+            }
+        }
+        std::chrono::duration<double, std::nano> spent = Clock::now() - start;
+        previewNanoseconds += (long long)spent.count();
+        return true;
+    });
+    std::chrono::duration<double, std::nano> previewTime = Clock::now() - previewStart;
+    
+    std::vector<DeadlineTile> tiles;
+    for (int y0 = 0; y0 < height; y0 += deadlineTileSize) {
+        for (int x0 = 0; x0 < width; x0 += deadlineTileSize) {
+            DeadlineTile tile;
+            tile.x0 = x0;
+            tile.y0 = y0;
+            tile.width = std::min(deadlineTileSize, width - x0);
+            tile.height = std::min(deadlineTileSize, height - y0);
+            float dx = x0 + tile.width/2.0f - width/2.0f;
+            float dy = y0 + tile.height/2.0f - height/2.0f;
+            tile.centreDistance = dx*dx + dy*dy;
+            tile.error = 0;
+            tile.samples = 0;
+            tiles.push_back(tile);
+        }
+    }
+    // Running sums of each pixel's samples and of their squared luminance, for
+    // this frame only; the render threads write them, this thread owns them
+    Arena &arena = threadArena();
+    ArenaScope scope(arena);
+    vec3* sums = arena.allocateArray<vec3>(width * height);
+    float* squares = arena.allocateArray<float>(width * height);
+    std::fill(sums, sums + width * height, vec3(0.0f));
+    std::fill(squares, squares + width * height, 0.0f);
+    
+    // Nanoseconds per camera sample so far, to predict how long a tile takes;
+    // the preview's rays are the first estimate
+    std::atomic<long long> spentNanoseconds(previewNanoseconds.load());
+    std::atomic<long long> samplesTaken(blocksX * blocksY);
+    
+    // Each round adds one sample to every tile, in priority order, until a tile would miss the deadline
+    bool stopped = false;
+    for (int round = 0; round < settings.samplesPerPixel && !stopped; round++) {
+        ArenaScope roundScope(arena);
+        ArenaVector<DeadlineTile*> order((ArenaAllocator<DeadlineTile*>(arena)));
+        order.reserve(tiles.size());
+        for (size_t t = 0; t < tiles.size(); t++) {
+            DeadlineTile &tile = tiles[t];
+            if (tile.samples > 0) {
+                float variance = 0;
+                for (int y = tile.y0; y < tile.y0 + tile.height; y++) {
+                    for (int x = tile.x0; x < tile.x0 + tile.width; x++) {
+                        float mean = luminance(sums[y*width + x]) / tile.samples;
+                        variance += glm::max(squares[y*width + x] / tile.samples - mean*mean, 0.0f);
+                    }
+                }
+                tile.error = variance / (tile.width * tile.height * tile.samples);
+            }
+            order.push_back(&tile);
+        }
+        std::stable_sort(order.begin(), order.end(), byPriority);
+        
+        std::atomic<int> finished(0);
+        parallelFor(threads, order.size(), [&](int i) {
+            DeadlineTile &tile = *order[i];
+            int pixels = tile.width * tile.height;
+            double predicted = (double)spentNanoseconds / samplesTaken * pixels * timeMargin;
+            Clock::time_point start = Clock::now();
+            if (start + std::chrono::nanoseconds((long long)predicted) > deadline) { return false; }
+            
+            TraceScope trace("tile", tile.x0 / deadlineTileSize, tile.y0 / deadlineTileSize);
+            for (int y = tile.y0; y < tile.y0 + tile.height; y++) {
+                for (int x = tile.x0; x < tile.x0 + tile.width; x++) {
+                    vec3 color = renderSample(scene, settings, x, y, round);
+                    sums[y*width + x] += color;
+                    squares[y*width + x] += luminance(color) * luminance(color);
+                }
+            }
+            tile.samples++;
+            std::chrono::duration<double, std::nano> spent = Clock::now() - start;
+            spentNanoseconds += (long long)spent.count();
+            samplesTaken += pixels;
+            finished++;
+            return true;
+        });
+        stopped = finished < (int)order.size();
+    }
+    
+    DeadlineReport report;
+    report.previewMs = previewTime.count() / 1e6;
+    report.minSamples = settings.samplesPerPixel;
+    report.maxSamples = 0;
+    double pixelSamples = 0;
+    for (size_t t = 0; t < tiles.size(); t++) {
+        const DeadlineTile &tile = tiles[t];
+        report.minSamples = std::min(report.minSamples, tile.samples);
+        report.maxSamples = std::max(report.maxSamples, tile.samples);
+        pixelSamples += (double)tile.samples * tile.width * tile.height;
+        if (tile.samples == 0) { continue; }
+        for (int y = tile.y0; y < tile.y0 + tile.height; y++) {
+            for (int x = tile.x0; x < tile.x0 + tile.width; x++) {
+                image.set(x, y, sums[y*width + x] / (float)tile.samples);
+            }
+        }
+    }
+    report.averageSamples = pixelSamples / ((double)width * height);
+    report.missedDeadline = Clock::now() > deadline;
+    return report;
+}
@@ -0,0 +1,37 @@
+//
+//  deadline.hpp
+//  
+//
+
+#ifndef deadline_hpp
+#define deadline_hpp
+
+#include <chrono>
+#include "render.hpp"
+
+// What a deadline render managed, in samples per pixel
+struct DeadlineReport {
+    double averageSamples;
+    int minSamples;
+    int maxSamples;
+    // Time the preview pass took, which is spent whatever the deadline
+    double previewMs;
+    // Whether the image was only ready after deadline: the preview alone
+    // took longer, or a tile ran over its predicted time
+    bool missedDeadline;
+};
+
+// Renders the best image it can by deadline, for callers with a latency
+// budget. A preview pass first traces one ray per 8x8 pixel block and fills
+// the whole image with it; this pass always runs to the end. Then 32 pixel
+// tiles get their first sample, those nearest the image centre first, and
+// further samples up to settings.samplesPerPixel, the noisiest tiles first
+// Tiles that would not finish before deadline, judged by the time samples
+// have taken so far, are not started, so the image is ready shortly after
+// deadline at the latest; the report says when it was not. Tiles never
+// reached keep the preview. With time to spare the image is the same as
+// renderPixels() makes
+// threads threads render (0 for one per core)
+DeadlineReport renderToDeadline( const Scene &scene, const RenderSettings &settings, std::chrono::steady_clock::time_point deadline, Framebuffer &image, int threads = 0 );
+
+#endif /* deadline_hpp */
@@ -0,0 +1,434 @@
+//
+//  distributed.cpp
+//  
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include "distributed.hpp"
+#include "render.hpp"
+#include "arena.hpp"
+
+static const char workerMagic[8] = { 'R','T','W','O','R','K','0','1' };
+static const char jobMagic[8] = { 'R','T','J','O','B','0','0','2' };
+// Tiles sent to a worker before it returns the first, so it never waits on the network
+static const int TILES_IN_FLIGHT = 2;
+// A connection that has not introduced itself as a worker after this long is
+// closed, as is one that stops reading what the coordinator sends
+static const int SOCKET_TIMEOUT_SECONDS = 30;
+
+static bool sendAll( int fd, const void* data, size_t size ) {
+    const char* bytes = (const char*) data;
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, 0);
+        if (sent <= 0) { return false; }
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool recvAll( int fd, void* data, size_t size ) {
+    char* bytes = (char*) data;
+    while (size > 0) {
+        ssize_t received = recv(fd, bytes, size, 0);
+        if (received <= 0) { return false; }
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+// Appends whatever the socket has ready to inbox without waiting for more
+// Returns false once the peer has closed the connection or it failed
+static bool recvAvailable( int fd, std::vector<char> &inbox ) {
+    char buffer[65536];
+    while (true) {
+        ssize_t received = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (received > 0) {
+            inbox.insert(inbox.end(), buffer, buffer + received);
+        } else {
+            return received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+        }
+    }
+}
+
+// The coordinator only reads what poll says is there; its messages to the
+// workers are small, but a worker that stops reading must not hold it forever
+static void setSocketOptions( int fd ) {
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    struct timeval timeout = { SOCKET_TIMEOUT_SECONDS, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+// A tile travels as its size and channel count followed by its pixels
+// The pixels are staged in the thread's arena for the length of the call
+static bool sendTile( int fd, Framebuffer &tile ) {
+    int dims[3] = { tile.getWidth(), tile.getHeight(), tile.getChannels() };
+    ArenaScope scope(threadArena());
+    size_t count = (size_t)dims[0] * dims[1] * dims[2];
+    float* pixels = threadArena().allocateArray<float>(count);
+    float* next = pixels;
+    for (int y = 0; y < dims[1]; y++) {
+        for (int x = 0; x < dims[0]; x++) {
+            if (dims[2] == 3) {
+                vec3 color = tile.get(x, y);
+                *next++ = color.x;
+                *next++ = color.y;
+                *next++ = color.z;
+            } else {
+                *next++ = tile.getValue(x, y);
+            }
+        }
+    }
+    return sendAll(fd, dims, sizeof(dims)) && sendAll(fd, pixels, count * sizeof(float));
+}
+
+static size_t tileBytes( int width, int height, int channels ) {
+    return 3*sizeof(int) + (size_t)width * height * channels * sizeof(float);
+}
+
+// Decodes a tile sent by sendTile from message, which must hold tileBytes of
+// it, and moves message past it
+static bool readTile( const char* &message, Framebuffer &tile, int width, int height, int channels ) {
+    int dims[3];
+    memcpy(dims, message, sizeof(dims));
+    if (dims[0] != width || dims[1] != height || dims[2] != channels) { return false; }
+    const char* pixels = message + sizeof(dims);
+    message += tileBytes(width, height, channels);
+    
+    tile.resize(width, height, channels);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float pixel[3];
+            memcpy(pixel, pixels + (size_t)(y*width + x) * channels * sizeof(float), channels * sizeof(float));
+            if (channels == 3) {
+                tile.set(x, y, vec3(pixel[0], pixel[1], pixel[2]));
+            } else {
+                tile.setValue(x, y, pixel[0]);
+            }
+        }
+    }
+    return true;
+}
+
+struct Worker {
+    int fd;
+    std::string name;
+    // Tiles sent and not yet returned, oldest first
+    std::deque<int> tiles;
+    // Received bytes of messages that are not complete yet
+    std::vector<char> inbox;
+    // When a tile last came back, or when the connection was accepted
+    std::chrono::steady_clock::time_point lastProgress;
+};
+
+static int listenOn( int port ) {
+    int fd = socket(AF_INET6, SOCK_STREAM, 0);
+    bool ipv6 = fd != -1;
+    if (!ipv6) { fd = socket(AF_INET, SOCK_STREAM, 0); }
+    if (fd == -1) { return -1; }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    
+    // Listen on every interface, IPv4 included when the socket is IPv6
+    bool bound;
+    if (ipv6) {
+        int off = 0;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+        struct sockaddr_in6 address;
+        memset(&address, 0, sizeof(address));
+        address.sin6_family = AF_INET6;
+        address.sin6_addr = in6addr_any;
+        address.sin6_port = htons(port);
+        bound = bind(fd, (struct sockaddr*) &address, sizeof(address)) == 0;
+    } else {
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        bound = bind(fd, (struct sockaddr*) &address, sizeof(address)) == 0;
+    }
+    if (!bound || listen(fd, 64) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Numeric address and port of a connected peer, for messages
+static std::string peerName( struct sockaddr_storage &address, socklen_t length ) {
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    if (getnameinfo((struct sockaddr*) &address, length, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+        return "unknown";
+    }
+    return std::string(host) + ":" + port;
+}
+
+bool coordinateTiles( int port, const Scene &scene, RenderState &state, std::vector<int> &tiles, float tileTimeout, TileReceiver receive ) {
+    int listener = listenOn(port);
+    if (listener == -1) { return false; }
+    // A worker vanishing while we write to it must not kill the coordinator
+    signal(SIGPIPE, SIG_IGN);
+    
+    int tilesX = (state.width + state.tileSize - 1) / state.tileSize;
+    int job[7] = { state.width, state.height, state.tileSize, state.samplesPerPixel, state.maxDepth, (int)state.seed, (int)state.aovMask };
+    uint64_t sceneHash = scene.hash();
+    std::deque<int> queue(tiles.begin(), tiles.end());
+    size_t remaining = tiles.size();
+    // Connections that have not sent the worker greeting yet, and workers
+    std::vector<Worker> joining;
+    std::vector<Worker> workers;
+    Framebuffer tile;
+    Framebuffer aovTiles[NUM_AOVS];
+    
+    // No call below waits on a single connection: everything is read as poll
+    // reports it and messages are handled once they have fully arrived, so a
+    // slow worker or a stray client cannot hold up the others
+    std::cerr << "Waiting for workers on port " << port << ", " << remaining << " tiles to render" << std::endl;
+    while (remaining > 0) {
+        // Keep every worker supplied
+        for (size_t w = 0; w < workers.size(); w++) {
+            while (!queue.empty() && (int)workers[w].tiles.size() < TILES_IN_FLIGHT) {
+                int index = queue.front();
+                int request[2] = { index % tilesX, index / tilesX };
+                if (!sendAll(workers[w].fd, request, sizeof(request))) { break; }
+                if (workers[w].tiles.empty()) { workers[w].lastProgress = std::chrono::steady_clock::now(); }
+                workers[w].tiles.push_back(index);
+                queue.pop_front();
+            }
+        }
+        
+        std::vector<struct pollfd> fds(1 + joining.size() + workers.size());
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (size_t j = 0; j < joining.size(); j++) {
+            fds[1 + j].fd = joining[j].fd;
+            fds[1 + j].events = POLLIN;
+        }
+        for (size_t w = 0; w < workers.size(); w++) {
+            fds[1 + joining.size() + w].fd = workers[w].fd;
+            fds[1 + joining.size() + w].events = POLLIN;
+        }
+        if (poll(&fds[0], fds.size(), 1000) < 0) { continue; }
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        
+        // New connections become workers once their greeting is in; the job
+        // header is small enough to go out without waiting
+        std::vector<bool> dropped(joining.size(), false);
+        for (size_t j = 0; j < joining.size(); j++) {
+            Worker &connection = joining[j];
+            bool open = fds[1 + j].revents == 0 || recvAvailable(connection.fd, connection.inbox);
+            std::chrono::duration<float> waited = now - connection.lastProgress;
+            if (connection.inbox.size() < sizeof(workerMagic)) {
+                dropped[j] = !open || waited.count() > SOCKET_TIMEOUT_SECONDS;
+                continue;
+            }
+            dropped[j] = true;
+            if (connection.inbox.size() != sizeof(workerMagic) || memcmp(&connection.inbox[0], workerMagic, sizeof(workerMagic)) != 0 || !open ||
+                !sendAll(connection.fd, jobMagic, sizeof(jobMagic)) || !sendAll(connection.fd, job, sizeof(job)) ||
+                !sendAll(connection.fd, &sceneHash, sizeof(sceneHash))) {
+                continue;
+            }
+            connection.inbox.clear();
+            connection.lastProgress = now;
+            workers.push_back(connection);
+            connection.fd = -1;
+            std::cerr << "Worker " << connection.name << " connected" << std::endl;
+        }
+        size_t joined = joining.size();
+        for (size_t j = joining.size(); j-- > 0; ) {
+            if (!dropped[j]) { continue; }
+            if (joining[j].fd != -1) { close(joining[j].fd); }
+            joining.erase(joining.begin() + j);
+        }
+        
+        // Workers that failed or stalled are dropped and their tiles re-issued
+        // Workers that joined above had nothing polled yet
+        dropped.assign(workers.size(), false);
+        size_t polled = fds.size() - 1 - joined;
+        for (size_t w = 0; w < polled; w++) {
+            Worker &worker = workers[w];
+            if (fds[1 + joined + w].revents != 0) {
+                bool open = recvAvailable(worker.fd, worker.inbox);
+                
+                // Each finished tile is its coordinates, then the beauty and AOV
+                // tiles; they come back in the order they were sent
+                size_t used = 0;
+                bool valid = true;
+                while (valid && worker.inbox.size() - used >= 2*sizeof(int)) {
+                    int done[2];
+                    memcpy(done, &worker.inbox[used], sizeof(done));
+                    valid = !worker.tiles.empty() && done[1]*tilesX + done[0] == worker.tiles.front();
+                    if (!valid) { break; }
+                    int x0 = done[0]*state.tileSize, y0 = done[1]*state.tileSize;
+                    int width = std::min(state.tileSize, state.width - x0);
+                    int height = std::min(state.tileSize, state.height - y0);
+                    size_t size = sizeof(done) + tileBytes(width, height, 3);
+                    for (int aov = 0; aov < NUM_AOVS; aov++) {
+                        if ((state.aovMask >> aov) & 1) { size += tileBytes(width, height, aovChannels[aov]); }
+                    }
+                    if (worker.inbox.size() - used < size) { break; }
+                    
+                    const char* message = &worker.inbox[used] + sizeof(done);
+                    valid = readTile(message, tile, width, height, 3);
+                    for (int aov = 0; aov < NUM_AOVS && valid; aov++) {
+                        if ((state.aovMask >> aov) & 1) { valid = readTile(message, aovTiles[aov], width, height, aovChannels[aov]); }
+                    }
+                    if (!valid) { break; }
+                    used += size;
+                    receive(done[0], done[1], tile, aovTiles);
+                    worker.tiles.pop_front();
+                    worker.lastProgress = now;
+                    remaining--;
+                }
+                worker.inbox.erase(worker.inbox.begin(), worker.inbox.begin() + used);
+                dropped[w] = !valid || !open;
+            }
+            std::chrono::duration<float> waited = now - worker.lastProgress;
+            if (!worker.tiles.empty() && waited.count() > tileTimeout) {
+                dropped[w] = true;
+            }
+        }
+        for (size_t w = workers.size(); w-- > 0; ) {
+            if (!dropped[w]) { continue; }
+            std::cerr << "Lost worker " << workers[w].name << ", re-issuing " << workers[w].tiles.size() << " tiles" << std::endl;
+            queue.insert(queue.begin(), workers[w].tiles.begin(), workers[w].tiles.end());
+            close(workers[w].fd);
+            workers.erase(workers.begin() + w);
+        }
+        
+        if (fds[0].revents & POLLIN) {
+            struct sockaddr_storage address;
+            socklen_t length = sizeof(address);
+            int fd = accept(listener, (struct sockaddr*) &address, &length);
+            if (fd == -1) { continue; }
+            setSocketOptions(fd);
+            Worker connection;
+            connection.fd = fd;
+            connection.name = peerName(address, length);
+            connection.lastProgress = now;
+            joining.push_back(connection);
+        }
+    }
+    
+    // Tile (-1,-1) tells the workers to exit
+    int finished[2] = { -1, -1 };
+    for (size_t w = 0; w < workers.size(); w++) {
+        sendAll(workers[w].fd, finished, sizeof(finished));
+        close(workers[w].fd);
+    }
+    for (size_t j = 0; j < joining.size(); j++) {
+        close(joining[j].fd);
+    }
+    close(listener);
+    return true;
+}
+
+static int connectTo( const char* address ) {
+    std::string host = address;
+    size_t colon = host.rfind(':');
+    if (colon == std::string::npos) { return -1; }
+    std::string port = host.substr(colon + 1);
+    host = host.substr(0, colon);
+    if (host.size() > 2 && host[0] == '[') { host = host.substr(1, host.size() - 2); }
+    
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* results;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &results) != 0) { return -1; }
+    
+    int fd = -1;
+    for (struct addrinfo* result = results; result != NULL && fd == -1; result = result->ai_next) {
+        fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        if (fd != -1 && connect(fd, result->ai_addr, result->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(results);
+    return fd;
+}
+
+int runWorker( const char* address, const Scene &scene ) {
+    // The coordinator may still be starting up
+    int fd = -1;
+    for (int attempt = 0; attempt < 50 && fd == -1; attempt++) {
+        fd = connectTo(address);
+        if (fd == -1) { usleep(200000); }
+    }
+    if (fd == -1) {
+        std::cerr << "Could not connect to " << address << std::endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    
+    char magic[8];
+    int job[7];
+    uint64_t sceneHash;
+    if (!sendAll(fd, workerMagic, sizeof(workerMagic)) || !recvAll(fd, magic, sizeof(magic)) ||
+        memcmp(magic, jobMagic, sizeof(magic)) != 0 || !recvAll(fd, job, sizeof(job)) || !recvAll(fd, &sceneHash, sizeof(sceneHash))) {
+        std::cerr << "No render job from " << address << std::endl;
+        close(fd);
+        return 1;
+    }
+    if (sceneHash != scene.hash()) {
+        std::cerr << "The coordinator renders a different scene than this worker" << std::endl;
+        close(fd);
+        return 1;
+    }
+    RenderSettings settings;
+    settings.width = job[0];
+    settings.height = job[1];
+    int tileSize = job[2];
+    settings.samplesPerPixel = job[3];
+    settings.maxDepth = job[4];
+    settings.seed = (unsigned) job[5];
+    for (int aov = 0; aov < NUM_AOVS; aov++) {
+        settings.aovEnabled[aov] = (job[6] >> aov) & 1;
+    }
+    
+    Framebuffer tile;
+    Framebuffer aovTiles[NUM_AOVS];
+    int request[2] = { 0, 0 };
+    int rendered = 0;
+    while (recvAll(fd, request, sizeof(request)) && request[0] >= 0) {
+        renderTile(scene, settings, request[0]*tileSize, request[1]*tileSize, tileSize, tile, aovTiles);
+        bool sent = sendAll(fd, request, sizeof(request)) && sendTile(fd, tile);
+        for (int aov = 0; aov < NUM_AOVS && sent; aov++) {
+            if (settings.aovEnabled[aov]) { sent = sendTile(fd, aovTiles[aov]); }
+        }
+        if (!sent) { break; }
+        rendered++;
+    }
+    close(fd);
+    
+    if (request[0] >= 0) {
+        std::cerr << "Lost the connection to " << address << " after " << rendered << " tiles" << std::endl;
+        return 1;
+    }
+    std::cerr << "Rendered " << rendered << " tiles for " << address << std::endl;
+    return 0;
+}
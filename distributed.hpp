@@ -0,0 +1,36 @@
+//
+//  distributed.hpp
+//  
+//
+
+#ifndef distributed_hpp
+#define distributed_hpp
+
+#include <vector>
+#include <functional>
+#include "framebuffer.hpp"
+#include "checkpoint.hpp"
+#include "render.hpp"
+
+// Tile rendering spread over worker processes connected over TCP
+// Workers are started from the same raytracer binary, so they build the same
+// scene; the coordinator sends its Scene::hash with the render settings, and
+// workers with a different scene refuse the job. Then it sends tile
+// coordinates, and the workers send back the rendered beauty and AOV tiles
+// Messages are raw host order integers and floats, so every node must share
+// the coordinator's byte order
+
+// Receives each finished tile, with the AOV tiles indexed by AOV
+typedef std::function<void(int tx, int ty, Framebuffer &tile, Framebuffer aovTiles[])> TileReceiver;
+
+// Listens on port and hands the tiles (row major indices) to the workers that
+// connect, a few at a time each. Tiles held by a worker that disconnects, or
+// that has not returned a tile for tileTimeout seconds, go to other workers
+// Returns once every tile was received, or false if port cannot be listened on
+bool coordinateTiles( int port, const Scene &scene, RenderState &state, std::vector<int> &tiles, float tileTimeout, TileReceiver receive );
+
+// Connects to a coordinator at host:port (retrying for a few seconds) and
+// renders the tiles it sends until it has no more. Returns the exit status
+int runWorker( const char* address, const Scene &scene );
+
+#endif /* distributed_hpp */
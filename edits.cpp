@@ -0,0 +1,170 @@
+//
+//  edits.cpp
+//  
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "edits.hpp"
+#include "incremental.hpp"
+#include "jobs.hpp"
+
+// One statement of an edits file; the has flags say which values it sets
+struct Edit {
+    int lineNumber;
+    std::string type;
+    int index;
+    bool hasPosition, hasRadius, hasDirection, hasFocal, hasIntensity;
+    bool hasDiffuse, hasSpecular, hasExponent, hasReflectance;
+    vec3 position, direction, intensity, diffuse, specular, reflectance;
+    float radius, focal, exponent;
+    float vertices[9];
+    std::string output;
+};
+
+static bool parseVector( const std::string &value, vec3 &v ) {
+    return sscanf(value.c_str(), "%f,%f,%f", &v.x, &v.y, &v.z) == 3;
+}
+
+static std::string parseEdit( const std::string &line, const Scene &scene, Edit &edit ) {
+    std::istringstream tokens(line);
+    tokens >> edit.type;
+    edit.index = -1;
+    edit.hasPosition = edit.hasRadius = edit.hasDirection = edit.hasFocal = edit.hasIntensity = false;
+    edit.hasDiffuse = edit.hasSpecular = edit.hasExponent = edit.hasReflectance = false;
+    
+    int count = 0;
+    if (edit.type == "sphere") {
+        count = scene.spheres.size();
+    } else if (edit.type == "mesh") {
+        count = scene.meshes.size();
+    } else if (edit.type == "material") {
+        count = scene.numObjects();
+    } else if (edit.type == "light") {
+        count = scene.lights.size();
+    } else if (edit.type != "camera" && edit.type != "render") {
+        return "unknown statement " + edit.type;
+    }
+    bool indexed = edit.type != "camera" && edit.type != "render";
+    if (indexed && (!(tokens >> edit.index) || edit.index < 0 || edit.index >= count)) {
+        return edit.type + " needs an index below " + std::to_string(count);
+    }
+    
+    bool hasVertices = false;
+    std::string token;
+    while (tokens >> token) {
+        size_t equals = token.find('=');
+        if (equals == std::string::npos) { return "expected key=value, got " + token; }
+        std::string key = token.substr(0, equals);
+        std::string value = token.substr(equals + 1);
+        bool valid = true;
+        if ((edit.type == "sphere" || edit.type == "light" || edit.type == "camera") && key == "position") {
+            valid = edit.hasPosition = parseVector(value, edit.position);
+        } else if (edit.type == "sphere" && key == "radius") {
+            edit.radius = atof(value.c_str());
+            valid = edit.hasRadius = edit.radius > 0;
+        } else if (edit.type == "mesh" && key == "vertices") {
+            float* v = edit.vertices;
+            valid = hasVertices = sscanf(value.c_str(), "%f,%f,%f,%f,%f,%f,%f,%f,%f", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8]) == 9;
+        } else if (edit.type == "material" && key == "diffuse") {
+            valid = edit.hasDiffuse = parseVector(value, edit.diffuse);
+        } else if (edit.type == "material" && key == "specular") {
+            valid = edit.hasSpecular = parseVector(value, edit.specular);
+        } else if (edit.type == "material" && key == "exponent") {
+            edit.exponent = atof(value.c_str());
+            edit.hasExponent = true;
+        } else if (edit.type == "material" && key == "reflectance") {
+            valid = edit.hasReflectance = parseVector(value, edit.reflectance);
+        } else if (edit.type == "light" && key == "intensity") {
+            valid = edit.hasIntensity = parseVector(value, edit.intensity);
+        } else if (edit.type == "camera" && key == "direction") {
+            valid = edit.hasDirection = parseVector(value, edit.direction) && glm::length(edit.direction) > 0;
+        } else if (edit.type == "camera" && key == "focal") {
+            edit.focal = atof(value.c_str());
+            valid = edit.hasFocal = edit.focal > 0;
+        } else if (edit.type == "render" && key == "output") {
+            edit.output = value;
+            valid = isImageFilename(value);
+        } else {
+            return "unknown " + edit.type + " key " + key;
+        }
+        if (!valid) { return "bad value for " + key + ": " + value; }
+    }
+    if (edit.type == "mesh" && !hasVertices) { return "mesh needs vertices="; }
+    if (edit.type == "render" && edit.output.empty()) { return "render needs output="; }
+    return "";
+}
+
+static void applyEdit( const Edit &edit, const Scene &scene, IncrementalRenderer &renderer ) {
+    if (edit.type == "sphere") {
+        const Sphere &sphere = scene.spheres[edit.index];
+        renderer.setSphere(edit.index, edit.hasPosition ? edit.position : sphere.getPosition(), edit.hasRadius ? edit.radius : sphere.getRadius());
+    } else if (edit.type == "mesh") {
+        renderer.setMeshVertices(edit.index, edit.vertices);
+    } else if (edit.type == "material") {
+        const Material &now = scene.objectMaterial(edit.index);
+        Material material(edit.hasDiffuse ? edit.diffuse : now.getDiffuse(), edit.hasSpecular ? edit.specular : now.getSpecular(),
+                          edit.hasExponent ? edit.exponent : now.getPhongExp(), edit.hasReflectance ? edit.reflectance : now.getReflectance());
+        renderer.setMaterial(edit.index, material);
+    } else if (edit.type == "light") {
+        Light light = scene.lights[edit.index];
+        if (edit.hasPosition) { light.position = edit.position; }
+        if (edit.hasIntensity) { light.intensity = edit.intensity; }
+        renderer.setLight(edit.index, light);
+    } else if (edit.type == "camera") {
+        Camera camera = scene.cam;
+        if (edit.hasPosition) { camera.position = edit.position; }
+        if (edit.hasDirection) { camera.direction = edit.direction; }
+        if (edit.hasFocal) { camera.focalLength = edit.focal; }
+        renderer.setCamera(camera);
+    }
+}
+
+int runEdits( const char* editsFile, Scene &scene, const RenderSettings &settings, int threads, int pngCompression ) {
+    std::ifstream file(editsFile);
+    if (!file) {
+        std::cerr << "Could not read " << editsFile << std::endl;
+        return 1;
+    }
+    
+    // Indexes are checked against the scene, which edits never add to or remove from
+    std::vector<Edit> edits;
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); lineNumber++) {
+        if (!line.empty() && line[line.size() - 1] == '\r') { line.erase(line.size() - 1); }
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] == '#') { continue; }
+        Edit edit;
+        edit.lineNumber = lineNumber;
+        std::string error = parseEdit(line, scene, edit);
+        if (!error.empty()) {
+            std::cerr << editsFile << ":" << lineNumber << ": " << error << std::endl;
+            return 1;
+        }
+        edits.push_back(edit);
+    }
+    
+    IncrementalRenderer renderer(scene, settings);
+    int failures = 0;
+    for (size_t i = 0; i < edits.size(); i++) {
+        if (edits[i].type != "render") {
+            applyEdit(edits[i], scene, renderer);
+            continue;
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int rendered = renderer.render(threads);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        fprintf(stderr, "Line %d: rendered %d of %d tiles in %.3f ms\n", edits[i].lineNumber, rendered, renderer.numTiles(), elapsed.count());
+        if (!saveImage(renderer.getImage(), edits[i].output, pngCompression)) {
+            std::cerr << "Could not write " << edits[i].output << std::endl;
+            failures++;
+        }
+    }
+    return failures > 0 ? 1 : 0;
+}
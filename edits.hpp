@@ -0,0 +1,27 @@
+//
+//  edits.hpp
+//  
+//
+
+#ifndef edits_hpp
+#define edits_hpp
+
+#include "render.hpp"
+
+// Replays a look development session against scene through an
+// IncrementalRenderer (see incremental.hpp). The edits file has one
+// statement per line, applied in order:
+//   sphere I [position=X,Y,Z] [radius=R]
+//   mesh I vertices=X0,Y0,Z0,X1,Y1,Z1,X2,Y2,Z2
+//   material I [diffuse=R,G,B] [specular=R,G,B] [exponent=P] [reflectance=R,G,B]
+//   light I [position=X,Y,Z] [intensity=R,G,B]
+//   camera [position=X,Y,Z] [direction=X,Y,Z] [focal=F]
+//   render output=FILE
+// I indexes the scene's spheres, meshes or lights; material indexes the
+// spheres first, then the meshes. Values left out keep their current value
+// render brings the image up to date and writes it; the first one renders
+// every tile. The file is checked before anything renders
+// Returns the process exit status
+int runEdits( const char* editsFile, Scene &scene, const RenderSettings &settings, int threads, int pngCompression );
+
+#endif /* edits_hpp */
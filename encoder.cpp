@@ -0,0 +1,68 @@
+//
+//  encoder.cpp
+//  
+//
+
+#include <iostream>
+#include "encoder.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+ImageEncoder::ImageEncoder(int count, size_t pending) : maxPending(pending), closed(false), failures(0) {
+    for (int i = 0; i < count; i++) {
+        threads.push_back(std::thread(&ImageEncoder::run, this));
+    }
+}
+
+ImageEncoder::~ImageEncoder() {
+    finish();
+}
+
+void ImageEncoder::run() {
+    if (traceEnabled) { setTraceThreadName("encoder"); }
+    while (true) {
+        Write write;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return closed || !queue.empty(); });
+            if (queue.empty()) { return; }
+            write = std::move(queue.front());
+            queue.pop_front();
+        }
+        changed.notify_all();
+        
+        bool saved;
+        {
+            STAT_TIMER(STAT_IMAGE_OUTPUT);
+            TRACE_SCOPE("encode");
+            saved = write.save();
+        }
+        if (!saved) {
+            std::cerr << "Could not write " << write.filename << std::endl;
+            std::lock_guard<std::mutex> lock(mutex);
+            failures++;
+        }
+    }
+}
+
+void ImageEncoder::submit(const std::string &filename, std::function<bool()> save) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&]() { return maxPending == 0 || queue.size() < maxPending; });
+    Write write;
+    write.filename = filename;
+    write.save = save;
+    queue.push_back(std::move(write));
+    changed.notify_all();
+}
+
+int ImageEncoder::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    changed.notify_all();
+    for (size_t i = 0; i < threads.size(); i++) {
+        if (threads[i].joinable()) { threads[i].join(); }
+    }
+    return failures;
+}
@@ -0,0 +1,48 @@
+//
+//  encoder.hpp
+//  
+//
+
+#ifndef encoder_hpp
+#define encoder_hpp
+
+#include <stddef.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Encodes and writes images on background threads so the caller can go on
+// rendering. Each write is timed as image output on the thread that runs it
+class ImageEncoder {
+    struct Write {
+        std::string filename;
+        std::function<bool()> save;
+    };
+    
+    size_t maxPending;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Write> queue;
+    bool closed;
+    int failures;
+    std::vector<std::thread> threads;
+    
+    void run();
+    
+public:
+    // submit() waits while maxPending writes are queued and not yet started,
+    // which bounds the memory held by images waiting to be written; 0 means no limit
+    ImageEncoder(int threads, size_t maxPending);
+    ~ImageEncoder();
+    // Queues save, which writes filename and returns false on failure
+    // Anything it refers to must stay alive until finish() returns
+    void submit(const std::string &filename, std::function<bool()> save);
+    // Waits for every queued write; returns how many failed
+    int finish();
+};
+
+#endif /* encoder_hpp */
@@ -0,0 +1,235 @@
+//
+//  framebuffer.cpp
+//  
+//
+
+#include <iostream>
+#include <string.h>
+#include <math.h>
+#include <cmath>
+#include <algorithm>
+#include <FreeImage.h>
+#include "framebuffer.hpp"
+#include "trace.hpp"
+
+Framebuffer::Framebuffer() {
+    width = 0;
+    height = 0;
+    channels = 3;
+}
+
+Framebuffer::Framebuffer(int w, int h, int c) {
+    resize(w, h, c);
+}
+
+void Framebuffer::resize(int w, int h, int c) {
+    width = w;
+    height = h;
+    channels = c;
+    data.assign(w * h * c, 0.0f);
+}
+
+int Framebuffer::getWidth() {
+    return width;
+}
+
+int Framebuffer::getHeight() {
+    return height;
+}
+
+int Framebuffer::getChannels() {
+    return channels;
+}
+
+float* Framebuffer::getData() {
+    return &data[0];
+}
+
+// (0,0) is the lower left corner, matching FreeImage
+void Framebuffer::set(int x, int y, vec3 color) {
+    float* pixel = &data[(y*width + x) * channels];
+    if (channels == 3) {
+        pixel[0] = color.x;
+        pixel[1] = color.y;
+        pixel[2] = color.z;
+    } else {
+        pixel[0] = color.x;
+    }
+}
+
+void Framebuffer::setValue(int x, int y, float value) {
+    set(x, y, vec3(value));
+}
+
+vec3 Framebuffer::get(int x, int y) {
+    float* pixel = &data[(y*width + x) * channels];
+    if (channels == 3) {
+        return vec3(pixel[0], pixel[1], pixel[2]);
+    }
+    return vec3(pixel[0]);
+}
+
+float Framebuffer::getValue(int x, int y) {
+    return data[(y*width + x) * channels];
+}
+
+// Copy a rendered tile into the buffer with its lower left corner at (x0,y0)
+void Framebuffer::setTile(int x0, int y0, Framebuffer &tile) {
+    for (int y = 0; y < tile.getHeight(); y++) {
+        float* src = &tile.data[y * tile.width * channels];
+        float* dst = &data[((y0 + y)*width + x0) * channels];
+        std::copy(src, src + tile.width * channels, dst);
+    }
+}
+
+// False colour rendering of a single channel buffer into colors, on the 0-255 scale
+// Values are scaled to the 99th percentile so a few outliers do not wash out the rest,
+// then mapped from cold to hot through black, blue, cyan, green, yellow and red.
+// The stops are RGB, the channel order every writer expects of a colour buffer
+void Framebuffer::heatmap(Framebuffer &colors) {
+    static const vec3 ramp[6] = { vec3(0,0,0), vec3(0,0,255), vec3(0,255,255), vec3(0,255,0), vec3(255,255,0), vec3(255,0,0) };
+    
+    std::vector<float> finite;
+    for (size_t i = 0; i < data.size(); i += channels) {
+        if (std::isfinite(data[i])) { finite.push_back(data[i]); }
+    }
+    float top = 0;
+    if (!finite.empty()) {
+        std::vector<float>::iterator nth = finite.begin() + (finite.size() - 1) * 99 / 100;
+        std::nth_element(finite.begin(), nth, finite.end());
+        top = *nth;
+    }
+    
+    colors.resize(width, height, 3);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float value = getValue(x, y);
+            float t = (top > 0 && std::isfinite(value)) ? glm::clamp(value / top, 0.0f, 1.0f) * 5 : 0;
+            int stop = glm::min((int)t, 4);
+            colors.set(x, y, glm::mix(ramp[stop], ramp[stop+1], t - stop));
+        }
+    }
+}
+
+// Raw dump of the buffer, used for checkpoints
+bool Framebuffer::write(FILE *file) {
+    int dims[3] = { width, height, channels };
+    return fwrite(dims, sizeof(int), 3, file) == 3 && fwrite(&data[0], sizeof(float), data.size(), file) == data.size();
+}
+
+bool Framebuffer::read(FILE *file) {
+    int dims[3];
+    if (fread(dims, sizeof(int), 3, file) != 3) { return false; }
+    resize(dims[0], dims[1], dims[2]);
+    return fread(&data[0], sizeof(float), data.size(), file) == data.size();
+}
+
+// Colour buffers are saved as RGB, single channel buffers as luminance (Y)
+// half selects 16-bit floats with PIZ compression instead of 32-bit floats
+bool Framebuffer::saveEXR(const char *filename, float scale, bool half) {
+    FIBITMAP* bitmap = FreeImage_AllocateT(channels == 3 ? FIT_RGBF : FIT_FLOAT, width, height);
+    if (bitmap == NULL) { return false; }
+    
+    for (int y = 0; y < height; y++) {
+        float* line = (float*) FreeImage_GetScanLine(bitmap, y);
+        for (int x = 0; x < width * channels; x++) {
+            line[x] = data[y*width*channels + x] * scale;
+        }
+    }
+    
+    bool success;
+    {
+        TRACE_SCOPE("FreeImage_Save");
+        success = FreeImage_Save(FIF_EXR, bitmap, filename, half ? EXR_DEFAULT : EXR_FLOAT);
+    }
+    FreeImage_Unload(bitmap);
+    return success;
+}
+
+// Portable float map: little endian floats, bottom row first
+bool Framebuffer::savePFM(const char *filename, float scale) {
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) { return false; }
+    
+    fprintf(file, "%s\n%d %d\n-1.0\n", channels == 3 ? "PF" : "Pf", width, height);
+    std::vector<float> line(width * channels);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width * channels; x++) {
+            line[x] = data[y*width*channels + x] * scale;
+        }
+        fwrite(&line[0], sizeof(float), line.size(), file);
+    }
+    
+    return fclose(file) == 0;
+}
+
+// Reads a PFM written by savePFM (or any little endian PFM), multiplying by scale
+bool Framebuffer::loadPFM(const char *filename, float scale) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) { return false; }
+    
+    char type[3] = { 0 };
+    int w, h;
+    float endian;
+    if (fscanf(file, "%2s %d %d %f", type, &w, &h, &endian) != 4 || fgetc(file) == EOF ||
+        (strcmp(type, "PF") != 0 && strcmp(type, "Pf") != 0) || w <= 0 || h <= 0 || endian >= 0) {
+        fclose(file);
+        return false;
+    }
+    resize(w, h, type[1] == 'F' ? 3 : 1);
+    bool success = fread(&data[0], sizeof(float), data.size(), file) == data.size();
+    for (size_t i = 0; i < data.size(); i++) { data[i] *= scale; }
+    
+    fclose(file);
+    return success;
+}
+
+// Tone map to 8 bits: scale by 2^exposure and clamp
+bool Framebuffer::savePNG(const char *filename, float exposure, int compression) {
+    int bitsPerPixel = 24;
+    FIBITMAP* bitmap = FreeImage_Allocate(width, height, bitsPerPixel);
+    if (bitmap == NULL) { return false; }
+    
+    float scale = powf(2.0f, exposure);
+    RGBQUAD color;
+    for (int x = 0; x < width; x++) {
+        for (int y = 0; y < height; y++) {
+            vec3 colVec = glm::min( get(x, y) * scale, vec3(255,255,255) );
+            color.rgbRed = colVec.x;
+            color.rgbGreen = colVec.y;
+            color.rgbBlue = colVec.z;
+            FreeImage_SetPixelColor(bitmap,x,y,&color);
+        }
+    }
+    
+    // zlib levels 1-9 map straight onto FreeImage's PNG_Z_* flags
+    int flags = compression < 0 ? PNG_DEFAULT : compression == 0 ? PNG_Z_NO_COMPRESSION : std::min(compression, 9);
+    bool success;
+    {
+        TRACE_SCOPE("FreeImage_Save");
+        success = FreeImage_Save(FIF_PNG, bitmap, filename, flags);
+    }
+    FreeImage_Unload(bitmap);
+    return success;
+}
+
+// Binary PPM with the same tone mapping as savePNG, top row first
+bool Framebuffer::savePPM(const char *filename, float exposure) {
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) { return false; }
+    
+    float scale = powf(2.0f, exposure);
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> line(width * 3);
+    for (int y = height - 1; y >= 0; y--) {
+        for (int x = 0; x < width; x++) {
+            vec3 colVec = glm::min( get(x, y) * scale, vec3(255,255,255) );
+            line[x*3+0] = colVec.x;
+            line[x*3+1] = colVec.y;
+            line[x*3+2] = colVec.z;
+        }
+        fwrite(&line[0], 1, line.size(), file);
+    }
+    
+    return fclose(file) == 0;
+}
@@ -0,0 +1,49 @@
+//
+//  framebuffer.hpp
+//  
+//
+
+#ifndef framebuffer_hpp
+#define framebuffer_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+typedef glm::vec3 vec3;
+
+// Floating point framebuffer with one or three channels per pixel
+// The beauty buffer holds the radiance returned by raytrace() on its 0-255
+// scale; callers pass a scale to the HDR writers to map 255 to 1.0
+class Framebuffer {
+    int width;
+    int height;
+    int channels;
+    std::vector<float> data;
+    
+public:
+    Framebuffer();
+    Framebuffer(int w, int h, int c = 3);
+    void resize(int w, int h, int c = 3);
+    int getWidth();
+    int getHeight();
+    int getChannels();
+    // Pixels in rows from the bottom up, channels interleaved
+    float* getData();
+    void set(int x, int y, vec3 color);
+    void setValue(int x, int y, float value);
+    vec3 get(int x, int y);
+    float getValue(int x, int y);
+    void setTile(int x0, int y0, Framebuffer &tile);
+    void heatmap(Framebuffer &colors);
+    bool write(FILE *file);
+    bool read(FILE *file);
+    bool saveEXR(const char *filename, float scale = 1.0f, bool half = true);
+    bool savePFM(const char *filename, float scale = 1.0f);
+    bool loadPFM(const char *filename, float scale = 1.0f);
+    // compression is the zlib level, 0 (none) to 9 (smallest); -1 keeps FreeImage's default of 6
+    bool savePNG(const char *filename, float exposure, int compression = -1);
+    bool savePPM(const char *filename, float exposure);
+};
+
+#endif /* framebuffer_hpp */
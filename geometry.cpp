@@ -7,6 +7,7 @@
 
 #include <iostream>
 #include "geometry.hpp"
+#include "stats.hpp"
 
 
 // Material Class
@@ -32,7 +33,7 @@ void Material::set(vec3 diff, vec3 spec, float p, vec3 ref) {
     reflectance = ref;
 }
 
-vec3 Material::calcShading(vec3 normal, Light light, vec3 lightDir) {
+vec3 Material::calcShading(vec3 normal, Light light, vec3 lightDir) const {
     vec3 total = vec3(0.0f);
     
     //Calculate diffuse component
@@ -47,10 +48,32 @@ vec3 Material::calcShading(vec3 normal, Light light, vec3 lightDir) {
     return glm::min( total, vec3(255,255,255) );
 }
 
-vec3 Material::getReflectance() {
+vec3 Material::getReflectance() const {
     return reflectance;
 }
 
+vec3 Material::getDiffuse() const {
+    return diffuse;
+}
+
+vec3 Material::getSpecular() const {
+    return specular;
+}
+
+float Material::getPhongExp() const {
+    return phongExp;
+}
+
+bool Material::operator<(const Material &other) const {
+    const float a[10] = { diffuse.x, diffuse.y, diffuse.z, specular.x, specular.y, specular.z, phongExp, reflectance.x, reflectance.y, reflectance.z };
+    const float b[10] = { other.diffuse.x, other.diffuse.y, other.diffuse.z, other.specular.x, other.specular.y, other.specular.z,
+                          other.phongExp, other.reflectance.x, other.reflectance.y, other.reflectance.z };
+    for (int i = 0; i < 10; i++) {
+        if (a[i] != b[i]) { return a[i] < b[i]; }
+    }
+    return false;
+}
+
 
 
 // Sphere Class
@@ -59,23 +82,31 @@ vec3 Material::getReflectance() {
 Sphere::Sphere() {
     position = vec3(0.0f);
     radius = 0;
-    material.set( vec3(0.0f), vec3(0.0f), 0, vec3(0.0f) );
+    material = 0;
 }
 
 // Constructor for the Sphere class
-Sphere::Sphere(vec3 pos, float rad, vec3 diff, vec3 spec, float p, vec3 ref) {
+Sphere::Sphere(vec3 pos, float rad, MaterialId mat) {
     position = pos;
     radius = rad;
-    material.set(diff, spec, p, ref);
+    material = mat;
 }
 
-void Sphere::set(vec3 pos, float rad, vec3 diff, vec3 spec, float p, vec3 ref) {
+void Sphere::setShape(vec3 pos, float rad) {
     position = pos;
     radius = rad;
-    material.set(diff, spec, p, ref);
 }
 
-bool Sphere::intersects(Ray ray, float &time, float minTime, float maxTime) {
+void Sphere::setMaterial(MaterialId mat) {
+    material = mat;
+}
+
+MaterialId Sphere::getMaterial() const {
+    return material;
+}
+
+bool Sphere::intersects(Ray ray, float &time, float minTime, float maxTime) const {
+    STAT_COUNT(STAT_SPHERE_TESTS);
     float t = 0.0;
     
     // Origin minus position (OMP)
@@ -111,7 +142,7 @@ bool Sphere::intersects(Ray ray, float &time, float minTime, float maxTime) {
 // Color and normal passed by reference
 // Determine if ray hits sphere, update color and normal
 // Return boolean value indicating if the sphere is hit
-bool Sphere::intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime) {
+bool Sphere::intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime) const {
     bool success = intersects(ray, time, minTime, maxTime);
     
     if (success) {
@@ -122,12 +153,12 @@ bool Sphere::intersects(Ray ray, vec3 &location, vec3 &normal, float &time, floa
     return success;
 }
 
-vec3 Sphere::calcShading(vec3 normal, Light light, vec3 lightDir) {
-    return material.calcShading(normal, light, lightDir);
+vec3 Sphere::getPosition() const {
+    return position;
 }
 
-vec3 Sphere::getReflectance() {
-    return material.getReflectance();
+float Sphere::getRadius() const {
+    return radius;
 }
 
 
@@ -139,37 +170,46 @@ Mesh::Mesh() {
     for (int i = 0; i < 9; i++) {
         vertices[i] = 0;
     }
+    material = 0;
 }
 
 // Vertices are stored counterclockwise
-Mesh::Mesh(float verts[], vec3 diff, vec3 spec, float p, vec3 ref) {
+Mesh::Mesh(const float verts[], MaterialId mat) {
     for (int i = 0; i < 9; i++) {
         vertices[i] = verts[i];
     }
-    material.set(diff, spec, p, ref);
+    material = mat;
 }
 
-void Mesh::set(float verts[], vec3 diff, vec3 spec, float p, vec3 ref) {
+void Mesh::setVertices(const float verts[]) {
     for (int i = 0; i < 9; i++) {
         vertices[i] = verts[i];
     }
-    material.set(diff, spec, p, ref);
 }
 
-vec3 Mesh::getVertex( int ind ) {
+void Mesh::setMaterial(MaterialId mat) {
+    material = mat;
+}
+
+MaterialId Mesh::getMaterial() const {
+    return material;
+}
+
+vec3 Mesh::getVertex( int ind ) const {
     if (ind >= 0 && ind < 3) {
         return vec3( vertices[(ind*3)+0], vertices[(ind*3)+1], vertices[(ind*3)+2] );
     }
     return vec3(0,0,0);
 }
 
-vec3 Mesh::getNormal() {
+vec3 Mesh::getNormal() const {
     vec3 edge1 = getVertex(1) - getVertex(0);
     vec3 edge2 = getVertex(2) - getVertex(0);
     return glm::normalize( glm::cross(edge1, edge2) );
 }
 
-bool Mesh::intersects(Ray ray, float &time, float minTime, float maxTime) {
+bool Mesh::intersects(Ray ray, float &time, float minTime, float maxTime) const {
+    STAT_COUNT(STAT_MESH_TESTS);
     vec3 edge_ba = getVertex(0) - getVertex(1);
     vec3 edge_ca = getVertex(0) - getVertex(2);
     vec3 aMinusOrigin = getVertex(0) - ray.origin;
@@ -210,7 +250,7 @@ bool Mesh::intersects(Ray ray, float &time, float minTime, float maxTime) {
     return false;
 }
 
-bool Mesh::intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime) {
+bool Mesh::intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime) const {
     bool success = intersects(ray, time, minTime, maxTime);
     
     if (success) {
@@ -221,11 +261,3 @@ bool Mesh::intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float
     return success;
 }
 
-vec3 Mesh::calcShading(vec3 normal, Light light, vec3 lightDir) {
-    return material.calcShading(normal, light, lightDir);
-}
-
-vec3 Mesh::getReflectance() {
-    return material.getReflectance();
-}
-
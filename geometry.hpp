@@ -9,8 +9,8 @@
 #define geometry_hpp
 
 #include <stdio.h>
+#include <stdint.h>
 #include <glm/glm.hpp>
-#include "variables.hpp"
 
 typedef glm::mat3 mat3;
 typedef glm::mat4 mat4;
@@ -22,6 +22,24 @@ struct Ray {
     vec3 path;
 };
 
+// State of one path in flight. It has a fixed size and holds no pointers,
+// so paths can be stored, batched, or suspended between bounces.
+struct PathState {
+    Ray ray;
+    vec3 throughput;
+    vec3 color;
+    int depth;
+};
+
+// Auxiliary values recorded at the first hit of a camera ray
+struct AOVSample {
+    float distance;
+    vec3 position;
+    vec3 normal;
+    vec3 albedo;
+    int object;
+};
+
 struct Camera {
     vec3 position;
     vec3 direction;
@@ -43,39 +61,53 @@ public:
     Material();
     Material(vec3 diff, vec3 spec, float p, vec3 ref);
     void set(vec3 diff, vec3 spec, float p, vec3 ref);
-    vec3 calcShading(vec3 normal, Light light, vec3 lightDir);
-    vec3 getReflectance();
+    vec3 calcShading(vec3 normal, Light light, vec3 lightDir) const;
+    vec3 getReflectance() const;
+    vec3 getDiffuse() const;
+    vec3 getSpecular() const;
+    float getPhongExp() const;
+    // Any strict order, so materials can be looked up when deduplicating
+    bool operator<(const Material &other) const;
 };
 
+// Index into the scene's material table (see Scene::addMaterial)
+typedef uint32_t MaterialId;
+
+// Spheres and meshes hold only what intersection reads, plus the ID of their
+// material, which is looked up for the closest hit only
 class Sphere {
     vec3 position;
     float radius;
-    Material material;
+    MaterialId material;
 public:
     Sphere();
-    Sphere(vec3 pos, float rad, vec3 diff, vec3 spec, float p, vec3 ref);
-    void set(vec3 pos, float rad, vec3 diff, vec3 spec, float p, vec3 ref);
-    bool intersects(Ray ray, float &time, float minTime, float maxTime);
-    bool intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime);
-    vec3 calcShading(vec3 normal, Light light, vec3 lightDir);
-    vec3 getReflectance();
+    Sphere(vec3 pos, float rad, MaterialId mat = 0);
+    // Moves or resizes the sphere, keeping its material
+    void setShape(vec3 pos, float rad);
+    void setMaterial(MaterialId mat);
+    MaterialId getMaterial() const;
+    bool intersects(Ray ray, float &time, float minTime, float maxTime) const;
+    bool intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime) const;
+    vec3 getPosition() const;
+    float getRadius() const;
 };
 
 class Mesh {
     // Vertices are stored counterclockwise
     float vertices[9];
-    Material material;
+    MaterialId material;
     
 public:
     Mesh();
-    Mesh(float verts[], vec3 diff, vec3 spec, float p, vec3 ref);
-    void set(float verts[], vec3 diff, vec3 spec, float p, vec3 ref);
-    vec3 getVertex( int ind );
-    vec3 getNormal();
-    bool intersects(Ray ray, float &time, float minTime, float maxTime);
-    bool intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime);
-    vec3 calcShading(vec3 normal, Light light, vec3 lightDir);
-    vec3 getReflectance();
+    Mesh(const float verts[], MaterialId mat = 0);
+    // Moves the vertices, keeping the material
+    void setVertices(const float verts[]);
+    void setMaterial(MaterialId mat);
+    MaterialId getMaterial() const;
+    vec3 getVertex( int ind ) const;
+    vec3 getNormal() const;
+    bool intersects(Ray ray, float &time, float minTime, float maxTime) const;
+    bool intersects(Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime) const;
 };
 
 
@@ -0,0 +1,150 @@
+//
+//  incremental.cpp
+//  
+//
+
+#include <limits>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "incremental.hpp"
+#include "trace.hpp"
+
+// Bounding sphere of an object, in one of its two poses
+struct ShapeBound {
+    vec3 center;
+    float radius;
+};
+
+static ShapeBound shapeBound( const Sphere &sphere ) {
+    ShapeBound bound = { sphere.getPosition(), sphere.getRadius() };
+    return bound;
+}
+
+static ShapeBound shapeBound( const Mesh &mesh ) {
+    ShapeBound bound;
+    bound.center = (mesh.getVertex(0) + mesh.getVertex(1) + mesh.getVertex(2)) / 3.0f;
+    bound.radius = 0;
+    for (int v = 0; v < 3; v++) { bound.radius = glm::max(bound.radius, glm::length(mesh.getVertex(v) - bound.center)); }
+    return bound;
+}
+
+// Whether a ray the tile cast may meet shape before the end it was recorded with
+static bool crosses( const TileRecord &record, const ShapeBound &shape ) {
+    if (record.cameraRays.meets(shape.center, shape.radius) || record.reflectionRays.meets(shape.center, shape.radius)) { return true; }
+    for (size_t l = 0; l < record.shadowRays.size(); l++) {
+        const RayBound &fromCamera = record.shadowRays[l];
+        const RayBound &fromReflections = record.reflectionShadowRays[l];
+        if (fromCamera.meets(shape.center, shape.radius) || fromCamera.reversed().meets(shape.center, shape.radius) ||
+            fromReflections.meets(shape.center, shape.radius) || fromReflections.reversed().meets(shape.center, shape.radius)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Marks the tiles a moved object can change: those that saw it before, or
+// whose rays may run through where it was or where it is now
+static void markMoved( const std::vector<TileRecord> &records, std::vector<bool> &dirty, int object, const ShapeBound &before, const ShapeBound &after ) {
+    for (size_t t = 0; t < records.size(); t++) {
+        if (dirty[t]) { continue; }
+        dirty[t] = records[t].hitObjects[object] || crosses(records[t], before) || crosses(records[t], after);
+    }
+}
+
+IncrementalRenderer::IncrementalRenderer(Scene &s, const RenderSettings &renderSettings, int size) : scene(s), settings(renderSettings), tileSize(size), image(renderSettings.width, renderSettings.height) {
+    tilesX = (settings.width + tileSize - 1) / tileSize;
+    tilesY = (settings.height + tileSize - 1) / tileSize;
+    records.resize(tilesX * tilesY);
+    dirty.assign(tilesX * tilesY, true);
+}
+
+void IncrementalRenderer::setSphere(int index, vec3 position, float radius) {
+    Sphere before = scene.spheres[index];
+    scene.spheres[index].setShape(position, radius);
+    markMoved(records, dirty, index, shapeBound(before), shapeBound(scene.spheres[index]));
+}
+
+void IncrementalRenderer::setMeshVertices(int index, const float vertices[]) {
+    Mesh before = scene.meshes[index];
+    scene.meshes[index].setVertices(vertices);
+    markMoved(records, dirty, scene.spheres.size() + index, shapeBound(before), shapeBound(scene.meshes[index]));
+}
+
+void IncrementalRenderer::setMaterial(int object, const Material &material) {
+    // Objects sharing the old material keep it
+    MaterialId id = scene.addMaterial(material);
+    int sphereCount = scene.spheres.size();
+    if (object < sphereCount) {
+        scene.spheres[object].setMaterial(id);
+    } else {
+        scene.meshes[object - sphereCount].setMaterial(id);
+    }
+    for (size_t t = 0; t < records.size(); t++) {
+        dirty[t] = dirty[t] || records[t].hitObjects[object];
+    }
+}
+
+void IncrementalRenderer::setLight(int index, const Light &light) {
+    // A brighter or dimmer light changes only what it reached; a moved one
+    // can also light or shadow anything it was tested from
+    bool moved = light.position != scene.lights[index].position;
+    scene.lights[index] = light;
+    for (size_t t = 0; t < records.size(); t++) {
+        dirty[t] = dirty[t] || (moved ? records[t].litBy[index] : records[t].contributedBy[index]);
+    }
+}
+
+void IncrementalRenderer::setCamera(const Camera &camera) {
+    scene.cam = camera;
+    dirty.assign(dirty.size(), true);
+}
+
+int IncrementalRenderer::numTiles() const {
+    return tilesX * tilesY;
+}
+
+int IncrementalRenderer::dirtyTiles() const {
+    return std::count(dirty.begin(), dirty.end(), true);
+}
+
+int IncrementalRenderer::render(int threads) {
+    std::vector<int> tiles;
+    for (size_t t = 0; t < dirty.size(); t++) {
+        if (dirty[t]) { tiles.push_back(t); }
+    }
+    if (tiles.empty()) { return 0; }
+    
+    if (threads <= 0) { threads = std::max(1u, std::thread::hardware_concurrency()); }
+    threads = std::min(threads, (int)tiles.size());
+    std::atomic<int> next(0);
+    float* data = image.getData();
+    auto work = [&]() {
+        for (int n = next++; n < (int)tiles.size(); n = next++) {
+            int tx = tiles[n] % tilesX;
+            int ty = tiles[n] / tilesX;
+            int x0 = tx*tileSize;
+            int y0 = ty*tileSize;
+            int w = std::min(tileSize, settings.width - x0);
+            int h = std::min(tileSize, settings.height - y0);
+            TraceScope trace("tile", tx, ty);
+            renderPixelsRecorded(scene, settings, x0, y0, w, h, data + ((size_t)y0*settings.width + x0)*3, (size_t)settings.width*3, records[tiles[n]]);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; i++) {
+        workers.push_back(std::thread([&]() {
+            if (traceEnabled) { setTraceThreadName("render"); }
+            work();
+        }));
+    }
+    work();
+    for (size_t i = 0; i < workers.size(); i++) { workers[i].join(); }
+    
+    dirty.assign(dirty.size(), false);
+    return tiles.size();
+}
+
+Framebuffer& IncrementalRenderer::getImage() {
+    return image;
+}
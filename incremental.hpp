@@ -0,0 +1,52 @@
+//
+//  incremental.hpp
+//  
+//
+
+#ifndef incremental_hpp
+#define incremental_hpp
+
+#include <vector>
+#include "render.hpp"
+
+// An image kept in step with edits to its scene, for look development
+// The first render() renders every tile and records what each tile's rays
+// touched (see TileRecord). Edits made through this class then mark only
+// the tiles they can change, and the next render() re-renders just those:
+// - a material change, the tiles that hit the object
+// - a light intensity change, the tiles the light reached unblocked
+// - a moved light, the tiles that evaluated it
+// - a moved object, the tiles that hit it or whose ray bounds meet its old
+//   or new bounding sphere, since it may now block or appear in them
+// - a camera change, every tile
+// Editing the scene directly instead leaves the image stale
+class IncrementalRenderer {
+    Scene &scene;
+    RenderSettings settings;
+    int tileSize;
+    int tilesX;
+    int tilesY;
+    Framebuffer image;
+    std::vector<TileRecord> records;
+    std::vector<bool> dirty;
+    
+public:
+    IncrementalRenderer(Scene &scene, const RenderSettings &settings, int tileSize = 32);
+    
+    void setSphere(int index, vec3 position, float radius);
+    void setMeshVertices(int index, const float vertices[]);
+    // object indexes the spheres first, then the meshes
+    void setMaterial(int object, const Material &material);
+    void setLight(int index, const Light &light);
+    void setCamera(const Camera &camera);
+    
+    int numTiles() const;
+    // Tiles waiting to be rendered again
+    int dirtyTiles() const;
+    // Renders the dirty tiles on threads threads (0 for one per core);
+    // returns how many there were
+    int render(int threads = 0);
+    Framebuffer& getImage();
+};
+
+#endif /* incremental_hpp */
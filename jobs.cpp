@@ -0,0 +1,85 @@
+//
+//  jobs.cpp
+//  
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include "jobs.hpp"
+
+// Largest image a job may ask for; at 12 bytes a pixel this keeps one
+// framebuffer under a gigabyte, so a bad request fails instead of taking
+// every byte the machine has
+static const long long maxJobPixels = 1LL << 26;
+
+static bool endsWith( const std::string &text, const char* suffix ) {
+    size_t length = strlen(suffix);
+    return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+}
+
+std::string parseRenderJob( const std::string &line, RenderJob &job ) {
+    job.scene.clear();
+    job.output.clear();
+    job.width = job.height = 500;
+    job.samplesPerPixel = 1;
+    job.seed = 0;
+    job.maxDepth = -1;
+    job.hasCamera = false;
+    job.camera = Camera();
+    job.deadlineMs = 0;
+    
+    std::istringstream tokens(line);
+    std::string token;
+    while (tokens >> token) {
+        size_t equals = token.find('=');
+        if (equals == std::string::npos) { return "expected key=value, got " + token; }
+        std::string key = token.substr(0, equals);
+        std::string value = token.substr(equals + 1);
+        if (key == "scene") {
+            job.scene = value;
+        } else if (key == "width") {
+            job.width = atoi(value.c_str());
+        } else if (key == "height") {
+            job.height = atoi(value.c_str());
+        } else if (key == "spp") {
+            job.samplesPerPixel = atoi(value.c_str());
+        } else if (key == "seed") {
+            job.seed = strtoul(value.c_str(), NULL, 10);
+        } else if (key == "depth") {
+            job.maxDepth = atoi(value.c_str());
+        } else if (key == "camera") {
+            Camera &c = job.camera;
+            if (sscanf(value.c_str(), "%f,%f,%f,%f,%f,%f,%f", &c.position.x, &c.position.y, &c.position.z,
+                       &c.direction.x, &c.direction.y, &c.direction.z, &c.focalLength) != 7) {
+                return "camera needs 7 numbers: position, direction, focal length";
+            }
+            job.hasCamera = true;
+        } else if (key == "deadline") {
+            job.deadlineMs = atof(value.c_str());
+            if (job.deadlineMs <= 0) { return "deadline must be positive"; }
+        } else if (key == "output") {
+            job.output = value;
+        } else {
+            return "unknown key " + key;
+        }
+    }
+    if (job.width <= 0 || job.height <= 0 || job.samplesPerPixel <= 0) { return "width, height and spp must be positive"; }
+    if ((long long)job.width * job.height > maxJobPixels) { return "width x height must be at most " + std::to_string(maxJobPixels) + " pixels"; }
+    if (!job.output.empty() && !isImageFilename(job.output)) {
+        return "output must end in .png, .ppm, .pfm or .exr";
+    }
+    return "";
+}
+
+bool isImageFilename( const std::string &filename ) {
+    return endsWith(filename, ".png") || endsWith(filename, ".ppm") || endsWith(filename, ".pfm") || endsWith(filename, ".exr");
+}
+
+bool saveImage( Framebuffer &framebuffer, const std::string &filename, int pngCompression ) {
+    if (endsWith(filename, ".png")) { return framebuffer.savePNG(filename.c_str(), 0, pngCompression); }
+    if (endsWith(filename, ".ppm")) { return framebuffer.savePPM(filename.c_str(), 0); }
+    if (endsWith(filename, ".pfm")) { return framebuffer.savePFM(filename.c_str(), 1/255.0f); }
+    return framebuffer.saveEXR(filename.c_str(), 1/255.0f);
+}
@@ -0,0 +1,44 @@
+//
+//  jobs.hpp
+//  
+//
+
+#ifndef jobs_hpp
+#define jobs_hpp
+
+#include <string>
+#include "render.hpp"
+
+// One render request as space separated key=value pairs, as sent to the
+// render server (see server.hpp) and listed in batch files (see batch.hpp):
+//   scene=NAME        built in scene (see scenes.hpp), default "default"
+//   width=N height=N  image size, default 500x500, at most 2^26 pixels
+//   spp=N seed=N      samples per pixel and sample seed, default 1 and 0
+//   depth=N           ray segments per camera ray, default the scene's
+//   camera=PX,PY,PZ,DX,DY,DZ,F  position, direction and focal length
+//   deadline=MS       render as well as possible in MS milliseconds (see deadline.hpp)
+//   output=FILE       .png, .ppm, .pfm or .exr image to write
+struct RenderJob {
+    // Empty if not given
+    std::string scene;
+    int width, height;
+    int samplesPerPixel;
+    unsigned int seed;
+    // -1 if not given
+    int maxDepth;
+    bool hasCamera;
+    Camera camera;
+    // 0 if not given
+    double deadlineMs;
+    std::string output;
+};
+
+// Returns an error message, or an empty string if the line is a valid job
+std::string parseRenderJob( const std::string &line, RenderJob &job );
+// Whether filename ends in one of the extensions saveImage writes
+bool isImageFilename( const std::string &filename );
+// Writes the image in the format its extension names; pngCompression is
+// passed on to Framebuffer::savePNG
+bool saveImage( Framebuffer &framebuffer, const std::string &filename, int pngCompression = -1 );
+
+#endif /* jobs_hpp */
@@ -7,137 +7,611 @@
 
 #include <stdio.h>
 #include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+#include <algorithm>
 #include <FreeImage.h>
 #include <glm/glm.hpp>
 #include "geometry.hpp"
-#include "variables.hpp"
+#include "framebuffer.hpp"
+#include "tiledframebuffer.hpp"
+#include "checkpoint.hpp"
+#include "render.hpp"
+#include "stats.hpp"
+#include "capture.hpp"
+#include "trace.hpp"
+#include "distributed.hpp"
+#include "scenes.hpp"
+#include "server.hpp"
+#include "batch.hpp"
+#include "encoder.hpp"
+#include "animation.hpp"
+#include "edits.hpp"
+#include "deadline.hpp"
 
 typedef glm::mat3 mat3;
 typedef glm::mat4 mat4;
 typedef glm::vec3 vec3;
 typedef glm::vec4 vec4;
 
-// screenHeight and screenWidth are expressed in pixels
-float screenHeight = 500;
-float screenWidth = 500;
+// Enable the AOVs named in a comma separated list
+bool parseAOVs( const char* list, bool enabled[] ) {
+    std::string names = list;
+    size_t start = 0;
+    while (start <= names.size()) {
+        size_t end = names.find(',', start);
+        if (end == std::string::npos) { end = names.size(); }
+        std::string name = names.substr(start, end - start);
+        
+        int aov = 0;
+        while (aov < NUM_AOVS && name != aovNames[aov]) { aov++; }
+        if (aov == NUM_AOVS) {
+            std::cerr << "Unknown AOV " << name << std::endl;
+            return false;
+        }
+        enabled[aov] = true;
+        start = end + 1;
+    }
+    return true;
+}
 
-struct Light lights[10];
-int lightsUsed;
+void writeCheckpoint( const char* checkpointFile, RenderState &state, std::vector<Framebuffer*> &buffers, TiledFramebuffer *tiled ) {
+    TRACE_SCOPE("checkpoint");
+    if ((tiled != NULL && !tiled->sync()) || !saveCheckpoint(checkpointFile, state, buffers)) {
+        std::cerr << "Could not write checkpoint " << checkpointFile << std::endl;
+    }
+}
 
-struct Camera cam = { vec3(0,5,0), vec3(0,-1,0), 1 };
+// Put a finished tile into the in memory buffers (beauty first, then the
+// enabled AOVs) or the out of core tile file, and mark it complete
+void storeTile( RenderState &state, std::vector<Framebuffer*> &buffers, TiledFramebuffer *tiled, int tx, int ty, Framebuffer &tile, Framebuffer aovTiles[] ) {
+    int x0 = tx*state.tileSize;
+    int y0 = ty*state.tileSize;
+    if (tiled != NULL) {
+        if (!tiled->writeTile(tx, ty, tile)) {
+            std::cerr << "Could not write tile " << tx << "," << ty << std::endl;
+        }
+    } else {
+        buffers[0]->setTile(x0, y0, tile);
+        int buffer = 1;
+        for (int aov = 0; aov < NUM_AOVS; aov++) {
+            if ((state.aovMask >> aov) & 1) { buffers[buffer++]->setTile(x0, y0, aovTiles[aov]); }
+        }
+    }
+    int tilesX = (state.width + state.tileSize - 1) / state.tileSize;
+    state.tileSamples[ty*tilesX + tx] = state.samplesPerPixel;
+}
 
-Sphere objects[10];
-//Mesh objects[10];
-int numObjects;
+void checkpointIfDue( RenderState &state, std::vector<Framebuffer*> &buffers, TiledFramebuffer *tiled, const char* checkpointFile, float checkpointInterval, std::chrono::steady_clock::time_point &lastCheckpoint ) {
+    std::chrono::duration<float> sinceCheckpoint = std::chrono::steady_clock::now() - lastCheckpoint;
+    if (checkpointFile != NULL && sinceCheckpoint.count() >= checkpointInterval) {
+        writeCheckpoint(checkpointFile, state, buffers, tiled);
+        lastCheckpoint = std::chrono::steady_clock::now();
+    }
+}
 
-Ray genCameraRay( int xCoor, int yCoor ) {
-    float worldHeight = screenHeight / 100;
-    float worldWidth = screenWidth / 100;
+// Render every tile that is not complete yet, either into the in memory buffers
+// or into an out of core tile file
+// Progress is checkpointed every checkpointInterval seconds if a checkpoint file is given
+void renderTiles( const Scene &scene, const RenderSettings &settings, RenderState &state, std::vector<Framebuffer*> &buffers, TiledFramebuffer *tiled, const char* checkpointFile, float checkpointInterval ) {
+    int tilesX = (state.width + state.tileSize - 1) / state.tileSize;
+    int tilesY = (state.height + state.tileSize - 1) / state.tileSize;
+    Framebuffer tile;
+    Framebuffer aovTiles[NUM_AOVS];
+    std::chrono::steady_clock::time_point lastCheckpoint = std::chrono::steady_clock::now();
     
-    vec3 right = glm::normalize( glm::cross( cam.direction, vec3(0.0,0.0,1.0) ) );
-    vec3 up = glm::normalize( glm::cross( right, cam.direction ) );
+    for (int ty = 0; ty < tilesY; ty++) {
+        for (int tx = 0; tx < tilesX; tx++) {
+            if (state.tileSamples[ty*tilesX + tx] >= state.samplesPerPixel) { continue; }
+            
+            {
+                TraceScope trace("tile", tx, ty);
+                renderTile(scene, settings, tx*state.tileSize, ty*state.tileSize, state.tileSize, tile, aovTiles);
+                storeTile(state, buffers, tiled, tx, ty, tile, aovTiles);
+            }
+            checkpointIfDue(state, buffers, tiled, checkpointFile, checkpointInterval, lastCheckpoint);
+        }
+    }
     
-    float u = (-worldWidth/2) + worldWidth*(xCoor+0.5)/screenWidth;
-    float v = (-worldHeight/2) + worldHeight*(yCoor+0.5)/screenHeight;
+    if (checkpointFile != NULL) {
+        writeCheckpoint(checkpointFile, state, buffers, tiled);
+    }
+}
+
+// Like renderTiles, but the tiles are rendered by worker processes (raytracer
+// --worker) that connect to port; see distributed.hpp
+bool distributeTiles( int port, float tileTimeout, const Scene &scene, RenderState &state, std::vector<Framebuffer*> &buffers, TiledFramebuffer *tiled, const char* checkpointFile, float checkpointInterval ) {
+    std::vector<int> tiles;
+    for (size_t index = 0; index < state.tileSamples.size(); index++) {
+        if (state.tileSamples[index] < state.samplesPerPixel) { tiles.push_back(index); }
+    }
+    std::chrono::steady_clock::time_point lastCheckpoint = std::chrono::steady_clock::now();
     
-    Ray camRay;
-    camRay.origin = cam.position;
-    // FreeImage begins at the lower left corner
-    camRay.path = (cam.focalLength * glm::normalize(cam.direction)) + (u*right) + (v*up);
+    bool distributed = coordinateTiles(port, scene, state, tiles, tileTimeout, [&](int tx, int ty, Framebuffer &tile, Framebuffer aovTiles[]) {
+        TraceScope trace("receive_tile", tx, ty);
+        storeTile(state, buffers, tiled, tx, ty, tile, aovTiles);
+        checkpointIfDue(state, buffers, tiled, checkpointFile, checkpointInterval, lastCheckpoint);
+    });
+    if (!distributed) {
+        std::cerr << "Could not listen on port " << port << std::endl;
+        return false;
+    }
     
-    return camRay;
+    if (checkpointFile != NULL) {
+        writeCheckpoint(checkpointFile, state, buffers, tiled);
+    }
+    return true;
+}
+
+void finishRayCapture( const char* captureFile ) {
+    if (captureFile != NULL && !closeRayCapture()) {
+        std::cerr << "Could not write " << captureFile << std::endl;
+    }
 }
 
-// Function is called once per view ray
-vec3 raytrace( Ray ray, int depth = 0 ) {
+void finishTrace( const char* traceFile ) {
+    if (traceFile != NULL && !writeTrace(traceFile)) {
+        std::cerr << "Could not write " << traceFile << std::endl;
+    }
+}
+
+// Every mode starts FreeImage through here, so traces show its start-up cost
+void initialiseFreeImage() {
+    TRACE_SCOPE("FreeImage_Initialise");
+    FreeImage_Initialise();
+}
+
+// Print the merged render statistics as a table and/or write them as JSON
+// Hardware counts are printed whenever they were recorded
+void reportStats( bool printTable, const char* jsonFile ) {
+    RenderStats stats = mergeStats();
+    if (printTable) {
+        printStatsTable(stderr, stats);
+    }
+    if (perfEnabled) {
+        printPerfTable(stderr, stats);
+    }
+    if (jsonFile != NULL) {
+        FILE* file = fopen(jsonFile, "w");
+        if (file == NULL) {
+            std::cerr << "Could not write " << jsonFile << std::endl;
+            return;
+        }
+        writeStatsJSON(file, stats);
+        fclose(file);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // --deadline counts from here, so it covers building the scene
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    Scene scene;
+    RenderSettings settings;
+    const char* sceneName = "default";
+    int depth = -1;
+    const char* pngFile = "image.png";
+    const char* exrFile = NULL;
+    const char* pfmFile = NULL;
+    float exposure = 0;
+    const char* ppmFile = NULL;
+    const char* tiledFile = NULL;
+    const char* exportFile = NULL;
+    const char* checkpointFile = NULL;
+    const char* resumeFile = NULL;
+    float checkpointInterval = 60;
+    int tileSize = 64;
+    const char* captureFile = NULL;
+    const char* traceFile = NULL;
+    bool perf = false;
+    int coordinatorPort = 0;
+    const char* workerAddress = NULL;
+    float tileTimeout = 60;
+    const char* serverSocket = NULL;
+    int cacheMegabytes = 256;
+    const char* batchFile = NULL;
+    int threads = 0;
+    int encodeThreads = 2;
+    int pngCompression = -1;
+    const char* animationFile = NULL;
+    int firstFrame = -1;
+    int lastFrame = -1;
+    float reprojectDegrees = -1;
+    bool reprojectMasks = false;
+    const char* editsFile = NULL;
+    double deadlineMs = 0;
+    bool printStats = false;
+    const char* statsFile = NULL;
+    int heatmapAOV = -1;
+    const char* aovPrefix = "image";
+    const char* aovFormat = "exr";
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--depth") == 0 && i+1 < argc) {
+            depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scene") == 0 && i+1 < argc) {
+            sceneName = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i+1 < argc) {
+            pngFile = argv[++i];
+        } else if (strcmp(argv[i], "--no-png") == 0) {
+            pngFile = NULL;
+        } else if (strcmp(argv[i], "--exr") == 0 && i+1 < argc) {
+            exrFile = argv[++i];
+        } else if (strcmp(argv[i], "--pfm") == 0 && i+1 < argc) {
+            pfmFile = argv[++i];
+        } else if (strcmp(argv[i], "--exposure") == 0 && i+1 < argc) {
+            exposure = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--ppm") == 0 && i+1 < argc) {
+            ppmFile = argv[++i];
+        } else if (strcmp(argv[i], "--width") == 0 && i+1 < argc) {
+            settings.width = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--height") == 0 && i+1 < argc) {
+            settings.height = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--spp") == 0 && i+1 < argc) {
+            settings.samplesPerPixel = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+            settings.seed = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--tile-size") == 0 && i+1 < argc) {
+            tileSize = atoi(argv[++i]);
+            if (tileSize <= 0) {
+                std::cerr << "--tile-size must be positive" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--tiled") == 0 && i+1 < argc) {
+            tiledFile = argv[++i];
+        } else if (strcmp(argv[i], "--export") == 0 && i+1 < argc) {
+            exportFile = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i+1 < argc) {
+            checkpointFile = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i+1 < argc) {
+            checkpointInterval = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--resume") == 0 && i+1 < argc) {
+            resumeFile = argv[++i];
+        } else if (strcmp(argv[i], "--capture") == 0 && i+1 < argc) {
+            captureFile = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i+1 < argc) {
+            traceFile = argv[++i];
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            perf = true;
+        } else if (strcmp(argv[i], "--perf-stages") == 0) {
+            perf = true;
+            perfStagesEnabled = true;
+        } else if (strcmp(argv[i], "--coordinator") == 0 && i+1 < argc) {
+            coordinatorPort = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--worker") == 0 && i+1 < argc) {
+            workerAddress = argv[++i];
+        } else if (strcmp(argv[i], "--tile-timeout") == 0 && i+1 < argc) {
+            tileTimeout = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--server") == 0 && i+1 < argc) {
+            serverSocket = argv[++i];
+        } else if (strcmp(argv[i], "--cache-mb") == 0 && i+1 < argc) {
+            cacheMegabytes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--batch") == 0 && i+1 < argc) {
+            batchFile = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--reproject") == 0 && i+1 < argc) {
+            reprojectDegrees = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--reproject-mask") == 0) {
+            reprojectMasks = true;
+        } else if (strcmp(argv[i], "--encode-threads") == 0 && i+1 < argc) {
+            encodeThreads = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--png-compression") == 0 && i+1 < argc) {
+            pngCompression = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--animate") == 0 && i+1 < argc) {
+            animationFile = argv[++i];
+        } else if (strcmp(argv[i], "--deadline") == 0 && i+1 < argc) {
+            deadlineMs = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--edits") == 0 && i+1 < argc) {
+            editsFile = argv[++i];
+        } else if (strcmp(argv[i], "--frames") == 0 && i+1 < argc) {
+            if (sscanf(argv[++i], "%d-%d", &firstFrame, &lastFrame) != 2 || firstFrame < 0 || lastFrame < firstFrame) {
+                std::cerr << "--frames needs a range A-B" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            printStats = true;
+            statTimersEnabled = true;
+        } else if (strcmp(argv[i], "--stats-json") == 0 && i+1 < argc) {
+            statsFile = argv[++i];
+            statTimersEnabled = true;
+        } else if (strcmp(argv[i], "--aov") == 0 && i+1 < argc) {
+            if (!parseAOVs(argv[++i], settings.aovEnabled)) { return 1; }
+        } else if (strcmp(argv[i], "--heatmap") == 0 && i+1 < argc) {
+            i++;
+            heatmapAOV = strcmp(argv[i], "tests") == 0 ? AOV_TESTS : strcmp(argv[i], "time") == 0 ? AOV_COST : -1;
+            if (heatmapAOV < 0) {
+                std::cerr << "Unknown heatmap metric " << argv[i] << std::endl;
+                return 1;
+            }
+            settings.aovEnabled[heatmapAOV] = true;
+        } else if (strcmp(argv[i], "--aov-prefix") == 0 && i+1 < argc) {
+            aovPrefix = argv[++i];
+        } else if (strcmp(argv[i], "--aov-format") == 0 && i+1 < argc) {
+            aovFormat = argv[++i];
+            if (strcmp(aovFormat, "exr") != 0 && strcmp(aovFormat, "pfm") != 0) {
+                std::cerr << "--aov-format must be exr or pfm" << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Unknown option or missing value: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    
+    if (traceFile != NULL) {
+        startTrace();
+        setTraceThreadName("main");
+    }
+    
+    // The server builds the scenes its jobs name and keeps them loaded
+    if (serverSocket != NULL) {
+        initialiseFreeImage();
+        int status = runServer(serverSocket, (size_t)cacheMegabytes << 20, threads, pngCompression);
+        FreeImage_DeInitialise();
+        reportStats(printStats, statsFile);
+        finishTrace(traceFile);
+        return status;
+    }
     
-    // Exit Condition
-    if (depth > 1) { return vec3(0.0f); }
+    // Without --depth the scene is traced as deep as it is meant to be
+    long long setupStart = traceEnabled ? traceClock() : 0;
+    int sceneDepth;
+    if (!buildNamedScene(scene, sceneName, sceneDepth)) {
+        std::cerr << "Unknown scene " << sceneName << std::endl;
+        return 1;
+    }
+    settings.maxDepth = depth > 0 ? depth : sceneDepth;
+    if (traceEnabled) { recordTraceEvent("scene_setup", setupStart, traceClock() - setupStart); }
     
-    vec3 color = vec3(0,0,0);
-    vec3 location = vec3(0,0,0);
-    vec3 normal = vec3(0,0,0);
-    float time = std::numeric_limits<float>::infinity();
-    int closestObj = -1;
+    // A batch renders every view in its file against the one scene built above
+    if (batchFile != NULL) {
+        initialiseFreeImage();
+        int status = runBatch(batchFile, scene, sceneName, settings.maxDepth, threads, encodeThreads, pngCompression);
+        FreeImage_DeInitialise();
+        reportStats(printStats, statsFile);
+        finishTrace(traceFile);
+        return status;
+    }
     
-    // Loop over every object
-    for (int obj = 0; obj < numObjects; obj++) {
-        // If the current object is intersected and closer than the previous object
-        if (objects[obj].intersects(ray, location, normal, time, 0.001, time)) {
-            closestObj = obj;
+    // An animation steps copies of the scene through its frames; --frames renders part of it
+    if (animationFile != NULL) {
+        Animation animation;
+        std::string error = animation.load(animationFile, scene);
+        if (error.empty() && !animation.job.scene.empty() && animation.job.scene != sceneName) {
+            error = "the animation renders the loaded scene " + std::string(sceneName) + ", not " + animation.job.scene;
+        }
+        if (!error.empty()) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        if (firstFrame >= 0) {
+            animation.firstFrame = firstFrame;
+            animation.lastFrame = lastFrame;
         }
+        initialiseFreeImage();
+        int status = runAnimation(animation, scene, settings.maxDepth, threads, encodeThreads, pngCompression, reprojectDegrees, reprojectMasks);
+        FreeImage_DeInitialise();
+        reportStats(printStats, statsFile);
+        finishTrace(traceFile);
+        return status;
+    }
+    
+    // Edits re-render only the tiles they change, writing an image at each render statement
+    if (editsFile != NULL) {
+        initialiseFreeImage();
+        int status = runEdits(editsFile, scene, settings, threads, pngCompression);
+        FreeImage_DeInitialise();
+        reportStats(printStats, statsFile);
+        finishTrace(traceFile);
+        return status;
     }
 
-    if (closestObj != -1) {
-        // Dummy variable to pass to the intersects function in place of time
-        float dummy;
-        
-        // Ambient term
-        color += vec3(0.1f);
-        bool inShadow;
+    // Workers take their settings from the coordinator and write no images
+    if (workerAddress != NULL) {
+        int status = runWorker(workerAddress, scene);
+        reportStats(printStats, statsFile);
+        finishTrace(traceFile);
+        return status;
+    }
+    
+    // A resumed render takes its settings from the checkpoint and keeps checkpointing to it
+    RenderState state;
+    if (resumeFile != NULL) {
+        if (!loadCheckpoint(resumeFile, state)) {
+            std::cerr << "Could not read checkpoint " << resumeFile << std::endl;
+            return 1;
+        }
+        if (state.outOfCore != (tiledFile != NULL)) {
+            std::cerr << "Checkpoint " << resumeFile << (state.outOfCore ? " needs" : " cannot be used with") << " --tiled" << std::endl;
+            return 1;
+        }
+        if (state.sceneHash != scene.hash()) {
+            std::cerr << "Checkpoint " << resumeFile << " was rendered from a different scene than " << sceneName << std::endl;
+            return 1;
+        }
+        settings.width = state.width;
+        settings.height = state.height;
+        tileSize = state.tileSize;
+        settings.samplesPerPixel = state.samplesPerPixel;
+        settings.maxDepth = state.maxDepth;
+        settings.seed = state.seed;
+        for (int aov = 0; aov < NUM_AOVS; aov++) {
+            settings.aovEnabled[aov] = (state.aovMask >> aov) & 1;
+        }
+        if (heatmapAOV >= 0 && !settings.aovEnabled[heatmapAOV]) {
+            std::cerr << "Checkpoint " << resumeFile << " does not record the " << aovNames[heatmapAOV] << " AOV needed for the heatmap" << std::endl;
+            return 1;
+        }
+        if (checkpointFile == NULL) { checkpointFile = resumeFile; }
+    } else {
+        state.width = settings.width;
+        state.height = settings.height;
+        state.tileSize = tileSize;
+        state.samplesPerPixel = settings.samplesPerPixel;
+        state.maxDepth = settings.maxDepth;
+        state.seed = settings.seed;
+        state.aovMask = 0;
+        for (int aov = 0; aov < NUM_AOVS; aov++) {
+            if (settings.aovEnabled[aov]) { state.aovMask |= 1 << aov; }
+        }
+        state.outOfCore = tiledFile != NULL;
+        state.sceneHash = scene.hash();
+        int tilesX = (state.width + tileSize - 1) / tileSize;
+        int tilesY = (state.height + tileSize - 1) / tileSize;
+        state.tileSamples.assign(tilesX * tilesY, 0);
+    }
+    
+    if (captureFile != NULL && !openRayCapture(captureFile, scene.spheres, scene.meshes)) {
+        std::cerr << "Could not create " << captureFile << std::endl;
+        return 1;
+    }
+    
+#ifdef NO_STATS
+    if (settings.aovEnabled[AOV_TESTS]) {
+        std::cerr << "The tests AOV needs the render statistics, which were compiled out" << std::endl;
+        return 1;
+    }
+    if (perf) {
+        std::cerr << "Hardware counters are recorded with the render statistics, which were compiled out" << std::endl;
+        return 1;
+    }
+#endif
+    std::string perfError;
+    if (perf && !openPerfCounters(perfError)) {
+        std::cerr << "Could not open hardware counters: " << perfError << std::endl;
+        return 1;
+    }
+    
+    // A deadline render refines one image in memory until time runs out
+    if (deadlineMs > 0 && (tiledFile != NULL || exportFile != NULL || resumeFile != NULL || checkpointFile != NULL || coordinatorPort > 0 || settings.anyAOV())) {
+        std::cerr << "--deadline cannot be combined with --tiled, --export, checkpoints, --coordinator or AOVs" << std::endl;
+        return 1;
+    }
+    
+    // Out of core images can only be streamed to formats written line by line
+    if (tiledFile != NULL || exportFile != NULL) {
+        if (settings.anyAOV() || exrFile != NULL) {
+            std::cerr << "AOVs and EXR output need the whole image in memory and are not available with --tiled" << std::endl;
+            return 1;
+        }
+        if (pfmFile == NULL && ppmFile == NULL) {
+            std::cerr << "--tiled and --export write only --pfm and --ppm images; give at least one" << std::endl;
+            return 1;
+        }
         
-        // Loop over every light in the scene
-        for (int i = 0; i < lightsUsed; i++) {
-            vec3 lightDir = glm::normalize(lights[i].position-location);
-            
-            //Test to see if any object blocks the light
-            Ray shadowRay = {location,lightDir};
-            inShadow = false;
-            int o = 0;
-            while (o < numObjects && inShadow == false) {
-                inShadow = objects[o].intersects(shadowRay, dummy, 0.01, std::numeric_limits<float>::infinity());
-                o++;
+        TiledFramebuffer tiled;
+        if (exportFile != NULL) {
+            if (!tiled.open(exportFile)) {
+                std::cerr << "Could not open " << exportFile << std::endl;
+                return 1;
             }
-            // If the object is not in shadow, calculate the lighting
-            if (inShadow == false) {
-                color += objects[closestObj].calcShading(normal, lights[i], lightDir);
+        } else {
+            bool opened = resumeFile != NULL ? tiled.open(tiledFile) : tiled.create(tiledFile, settings.width, settings.height, 3, tileSize);
+            if (!opened || tiled.getWidth() != state.width || tiled.getHeight() != state.height || tiled.getTileSize() != tileSize) {
+                std::cerr << "Could not " << (resumeFile != NULL ? "open " : "create ") << tiledFile << std::endl;
+                return 1;
             }
+            std::vector<Framebuffer*> noBuffers;
+            {
+                STAT_TIMER(STAT_RENDER_LOOP);
+                if (coordinatorPort > 0) {
+                    if (!distributeTiles(coordinatorPort, tileTimeout, scene, state, noBuffers, &tiled, checkpointFile, checkpointInterval)) { return 1; }
+                } else {
+                    renderTiles(scene, settings, state, noBuffers, &tiled, checkpointFile, checkpointInterval);
+                }
+            }
+            finishRayCapture(captureFile);
         }
         
-        // Calculate reflection ray and recurse
-        ray.origin = location;
-        vec3 path = glm::normalize(ray.path);
-        ray.path = path - 2*(glm::dot(path,normal))*normal;
-        
-        color = color + objects[closestObj].getReflectance() * raytrace(ray, depth+1);
+        bool failed = false;
+        {
+            STAT_TIMER(STAT_IMAGE_OUTPUT);
+            TRACE_SCOPE("image_output");
+            if (pfmFile != NULL && !tiled.exportPFM(pfmFile, 1/255.0f)) {
+                std::cerr << "Could not write " << pfmFile << std::endl;
+                failed = true;
+            }
+            if (ppmFile != NULL && !tiled.exportPPM(ppmFile, exposure)) {
+                std::cerr << "Could not write " << ppmFile << std::endl;
+                failed = true;
+            }
+        }
+        reportStats(printStats, statsFile);
+        finishTrace(traceFile);
+        return failed ? 1 : 0;
     }
     
-    return color;
-}
-
-int main(int argc, char* argv[]) {
-    lights[0].position = vec3(5,5,0);
-    lights[0].intensity = vec3(1,1,1);
-    lights[1].position = vec3(0,5,0);
-    lights[1].intensity = vec3(0.5,0.5,0.5);
-    lightsUsed = 2;
-    
-    objects[0].set(vec3(3,0,0), 3, vec3(100,100,100), vec3(100,100,100), 100, vec3(0.6f));
-    objects[1].set(vec3(-3,0,0), 2, vec3(200,0,0), vec3(100,100,100), 100, vec3(0.0f));
-    
-//    float verts[9] = {10,0,10, 6,0,0, 0,0,6};
-//    objects[0].set(verts, vec3(100,100,100), vec3(0,0,0), 100, vec3(0.0f));
-//    float verts2[9] = {2,3,4, 2,3,-4, 1,0,0};
-//    objects[1].set(verts2, vec3(200,0,0), vec3(100,100,100), 100, vec3(0,0.6,0));
-    numObjects = 2;
-
-    FreeImage_Initialise();
+    initialiseFreeImage();
 
-    int bitsPerPixel = 24;
-    FIBITMAP* bitmap = FreeImage_Allocate(screenWidth, screenHeight, bitsPerPixel);
+    Framebuffer framebuffer(settings.width, settings.height);
+    Framebuffer aovBuffers[NUM_AOVS];
+    std::vector<Framebuffer*> buffers(1, &framebuffer);
+    for (int aov = 0; aov < NUM_AOVS; aov++) {
+        if (settings.aovEnabled[aov]) {
+            aovBuffers[aov].resize(settings.width, settings.height, aovChannels[aov]);
+            buffers.push_back(&aovBuffers[aov]);
+        }
+    }
+    
+    if (resumeFile != NULL && !loadCheckpointBuffers(resumeFile, buffers)) {
+        std::cerr << "Could not read checkpoint " << resumeFile << std::endl;
+        return 1;
+    }
+    {
+        STAT_TIMER(STAT_RENDER_LOOP);
+        if (deadlineMs > 0) {
+            DeadlineReport achieved = renderToDeadline(scene, settings, started + std::chrono::microseconds((long long)(deadlineMs * 1000)), framebuffer, threads);
+            fprintf(stderr, "Deadline %.3f ms %s: %.2f samples per pixel (%d to %d), preview %.3f ms\n", deadlineMs, achieved.missedDeadline ? "missed" : "met",
+                    achieved.averageSamples, achieved.minSamples, achieved.maxSamples, achieved.previewMs);
+        } else if (coordinatorPort > 0) {
+            if (!distributeTiles(coordinatorPort, tileTimeout, scene, state, buffers, NULL, checkpointFile, checkpointInterval)) { return 1; }
+        } else {
+            renderTiles(scene, settings, state, buffers, NULL, checkpointFile, checkpointInterval);
+        }
+    }
+    finishRayCapture(captureFile);
     
-    RGBQUAD color;
-    for (int i = 0; i < screenWidth; i++) {
-        for (int j = 0; j < screenHeight; j++) {
-            vec3 colVec = raytrace( genCameraRay(i,j) );
-            colVec = glm::min( colVec, vec3(255,255,255) );
-            color.rgbRed = colVec.z;
-            color.rgbGreen = colVec.y;
-            color.rgbBlue = colVec.x;
-            FreeImage_SetPixelColor(bitmap,i,j,&color);
+    // The outputs are encoded side by side on the encoder threads, which also
+    // time them; the buffers stay alive until finish() returns
+    {
+        TRACE_SCOPE("image_output");
+        ImageEncoder encoder(encodeThreads, 0);
+        if (exrFile != NULL) {
+            encoder.submit(exrFile, [&]() { return framebuffer.saveEXR(exrFile, 1/255.0f); });
+        }
+        if (pfmFile != NULL) {
+            encoder.submit(pfmFile, [&]() { return framebuffer.savePFM(pfmFile, 1/255.0f); });
+        }
+        if (ppmFile != NULL) {
+            encoder.submit(ppmFile, [&]() { return framebuffer.savePPM(ppmFile, exposure); });
+        }
+        // AOVs are written as full precision floats, one file each: <prefix>.<name>.<format>
+        std::string aovFiles[NUM_AOVS];
+        for (int aov = 0; aov < NUM_AOVS; aov++) {
+            if (!settings.aovEnabled[aov]) { continue; }
+            aovFiles[aov] = std::string(aovPrefix) + "." + aovNames[aov] + "." + aovFormat;
+            Framebuffer &buffer = aovBuffers[aov];
+            const std::string &filename = aovFiles[aov];
+            bool pfm = strcmp(aovFormat, "pfm") == 0;
+            encoder.submit(filename, [&buffer, &filename, pfm]() { return pfm ? buffer.savePFM(filename.c_str()) : buffer.saveEXR(filename.c_str(), 1.0f, false); });
+        }
+        // The raw heatmap data is its AOV file; this adds a false colour image of it
+        Framebuffer colors;
+        std::string heatmapFile = std::string(aovPrefix) + ".heatmap.png";
+        if (heatmapAOV >= 0) {
+            aovBuffers[heatmapAOV].heatmap(colors);
+            encoder.submit(heatmapFile, [&]() { return colors.savePNG(heatmapFile.c_str(), 0, pngCompression); });
+        }
+        // The 8-bit image is an optional tone mapped post pass over the float buffer
+        if (pngFile != NULL) {
+            encoder.submit(pngFile, [&]() { return framebuffer.savePNG(pngFile, exposure, pngCompression); });
         }
+        encoder.finish();
     }
     
-    FreeImage_Save(FIF_PNG, bitmap, "image.png", 0);
     FreeImage_DeInitialise();
+    reportStats(printStats, statsFile);
+    finishTrace(traceFile);
 }
@@ -0,0 +1,278 @@
+//
+//  microbench.cpp
+//  
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "render.hpp"
+#include "shading.hpp"
+
+// Microbenchmarks for the hot kernels
+// Each kernel runs over randomized batches of rays and primitives built for a
+// chosen hit rate. Every implementation of a kernel is timed against its
+// scalar baseline, which is always the first variant listed for that kernel
+
+// Deterministic generator so every run sees the same batches
+static unsigned int benchState = 1;
+static float benchRandom( float lo, float hi ) {
+    benchState ^= benchState << 13;
+    benchState ^= benchState >> 17;
+    benchState ^= benchState << 5;
+    return lo + (hi - lo) * (benchState >> 8) * (1.0f / 16777216.0f);
+}
+
+static vec3 randomUnit() {
+    vec3 v;
+    do {
+        v = vec3(benchRandom(-1, 1), benchRandom(-1, 1), benchRandom(-1, 1));
+    } while (glm::dot(v, v) > 1 || glm::dot(v, v) < 1e-4f);
+    return glm::normalize(v);
+}
+
+// Any unit vector perpendicular to v
+static vec3 perpendicular( vec3 v ) {
+    vec3 axis = glm::abs(v.x) < 0.9f ? vec3(1,0,0) : vec3(0,1,0);
+    return glm::normalize(glm::cross(v, axis));
+}
+
+struct KernelBatch {
+    std::vector<Ray> rays;
+    std::vector<Sphere> spheres;
+    std::vector<Mesh> meshes;
+    std::vector<Material> materials;
+    std::vector<vec3> normals;
+    std::vector<vec3> lightDirs;
+    // The same hits as normals, lightDirs and materials, for batched shading
+    Arena arena;
+    ShadingBatch shading;
+    MaterialColumns materialColumns;
+    std::vector<int> pixels;
+    Light light;
+    // Camera rays are generated for the default scene and settings
+    Scene scene;
+    RenderSettings settings;
+};
+
+// Rays aimed so that a fraction hitRate of (ray, primitive) pairs intersect
+void buildBatch( KernelBatch &batch, int size, float hitRate ) {
+    benchState = 1;
+    for (int i = 0; i < size; i++) {
+        bool hit = benchRandom(0, 1) < hitRate;
+        vec3 center = vec3(benchRandom(-10, 10), benchRandom(-10, 10), benchRandom(-10, 10));
+        float radius = benchRandom(0.5f, 2.0f);
+        vec3 dir = randomUnit();
+        vec3 origin = center - dir * benchRandom(5, 20);
+        
+        // Sphere: pass inside or outside the radius at the closest approach
+        vec3 side = perpendicular(dir);
+        float offset = hit ? benchRandom(0, 0.95f) : benchRandom(1.05f, 3.0f);
+        Ray ray = { origin, glm::normalize(center + side * offset * radius - origin) * benchRandom(0.5f, 2.0f) };
+        batch.rays.push_back(ray);
+        batch.spheres.push_back(Sphere(center, radius));
+        
+        // Triangle: around the point the ray passes through, containing it or not
+        vec3 target = origin + ray.path * (glm::length(center - origin) / glm::length(ray.path));
+        vec3 u = perpendicular(ray.path);
+        vec3 v = glm::normalize(glm::cross(ray.path, u));
+        vec3 shift = hit ? vec3(0.0f) : u * (radius * 3);
+        vec3 a = target + shift + u * radius;
+        vec3 b = target + shift - u * (radius * 0.5f) + v * radius;
+        vec3 c = target + shift - u * (radius * 0.5f) - v * radius;
+        float verts[9] = { a.x, a.y, a.z, b.x, b.y, b.z, c.x, c.y, c.z };
+        batch.meshes.push_back(Mesh(verts));
+        
+        vec3 diffuse = vec3(benchRandom(0, 255), benchRandom(0, 255), benchRandom(0, 255));
+        batch.materials.push_back(Material(diffuse, vec3(100), benchRandom(1, 200), vec3(0.0f)));
+        batch.normals.push_back(randomUnit());
+        batch.lightDirs.push_back(randomUnit());
+        batch.pixels.push_back(benchState % (batch.settings.width * batch.settings.height));
+    }
+    Light light = { vec3(5,5,0), vec3(1,1,1) };
+    batch.light = light;
+    
+    ShadingBatch &shading = batch.shading;
+    shading.allocate(batch.arena, size);
+    batch.materialColumns.build(batch.arena, &batch.materials[0], size);
+    for (int i = 0; i < size; i++) {
+        shading.normalX[i] = batch.normals[i].x;
+        shading.normalY[i] = batch.normals[i].y;
+        shading.normalZ[i] = batch.normals[i].z;
+        shading.lightX[i] = batch.lightDirs[i].x;
+        shading.lightY[i] = batch.lightDirs[i].y;
+        shading.lightZ[i] = batch.lightDirs[i].z;
+        shading.intensityR[i] = light.intensity.x;
+        shading.intensityG[i] = light.intensity.y;
+        shading.intensityB[i] = light.intensity.z;
+        shading.material[i] = i;
+    }
+}
+
+// A kernel implementation runs calls calls over the batch and returns a checksum
+// (hit count or summed output) so the work cannot be optimized away
+typedef double (*KernelFunc)( KernelBatch &batch, long calls );
+
+static double sphereScalar( KernelBatch &batch, long calls ) {
+    double hits = 0;
+    size_t n = batch.rays.size();
+    for (long i = 0; i < calls; i++) {
+        float time;
+        hits += batch.spheres[i % n].intersects(batch.rays[i % n], time, 0.001f, std::numeric_limits<float>::infinity());
+    }
+    return hits;
+}
+
+static double meshScalar( KernelBatch &batch, long calls ) {
+    double hits = 0;
+    size_t n = batch.rays.size();
+    for (long i = 0; i < calls; i++) {
+        float time;
+        hits += batch.meshes[i % n].intersects(batch.rays[i % n], time, 0.001f, std::numeric_limits<float>::infinity());
+    }
+    return hits;
+}
+
+// Summed in double like shadingSIMD, so the checksums differ only by the shading
+static double shadingScalar( KernelBatch &batch, long calls ) {
+    double total = 0;
+    size_t n = batch.rays.size();
+    for (long i = 0; i < calls; i++) {
+        vec3 color = batch.materials[i % n].calcShading(batch.normals[i % n], batch.light, batch.lightDirs[i % n]);
+        total += color.x + color.y + color.z;
+    }
+    return total;
+}
+
+// Whole passes over the batch, then part of one for the remaining calls
+static double shadingSIMD( KernelBatch &batch, long calls ) {
+    ShadingBatch &shading = batch.shading;
+    size_t n = batch.rays.size();
+    double total = 0;
+    for (long done = 0; done < calls; done += shading.count) {
+        shading.count = std::min((long)n, calls - done);
+        shadeBatch(batch.materialColumns, shading);
+        for (size_t i = 0; i < shading.count; i++) {
+            total += shading.red[i] + shading.green[i] + shading.blue[i];
+        }
+    }
+    shading.count = n;
+    return total;
+}
+
+static double cameraRayScalar( KernelBatch &batch, long calls ) {
+    vec3 total = vec3(0.0f);
+    size_t n = batch.pixels.size();
+    int width = batch.settings.width;
+    for (long i = 0; i < calls; i++) {
+        int pixel = batch.pixels[i % n];
+        total += genCameraRay(batch.scene, batch.settings, pixel % width, pixel / width).path;
+    }
+    return total.x + total.y + total.z;
+}
+
+struct KernelVariant {
+    const char* kernel;
+    const char* variant;
+    KernelFunc func;
+    // Whether the checksum is a hit count, used to report the achieved hit rate
+    bool countsHits;
+};
+
+static KernelVariant variants[] = {
+    { "sphere_intersect", "scalar", sphereScalar, true },
+    { "mesh_intersect", "scalar", meshScalar, true },
+    { "calc_shading", "scalar", shadingScalar, false },
+    { "calc_shading", "simd8", shadingSIMD, false },
+    { "gen_camera_ray", "scalar", cameraRayScalar, false },
+};
+static const int numVariants = sizeof(variants) / sizeof(variants[0]);
+// Largest relative difference from the scalar checksum an alternative may
+// show; shadeBatch's approximated pow is documented to about 1e-5
+static const double checksumTolerance = 1e-5;
+
+int main(int argc, char* argv[]) {
+    int batchSize = 4096;
+    long calls = 2000000;
+    float hitRate = 0.5f;
+    const char* onlyKernel = NULL;
+    bool json = false;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0 && i+1 < argc) {
+            batchSize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--calls") == 0 && i+1 < argc) {
+            calls = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--hit-rate") == 0 && i+1 < argc) {
+            hitRate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--kernel") == 0 && i+1 < argc) {
+            onlyKernel = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        }
+    }
+    
+    KernelBatch batch;
+    buildBatch(batch, batchSize, hitRate);
+    
+    if (json) {
+        printf("{\"microbenchmark\": \"raytracer\", \"batch\": %d, \"calls\": %ld, \"hit_rate\": %.3f, \"results\": [\n", batchSize, calls, hitRate);
+    } else {
+        printf("%-18s %-10s %10s %12s %10s %10s %10s\n", "kernel", "variant", "ns/call", "Mcalls/s", "speedup", "hit rate", "error");
+    }
+    
+    double baselineNanos = 0;
+    double baselineChecksum = 0;
+    int mismatches = 0;
+    bool first = true;
+    for (int v = 0; v < numVariants; v++) {
+        KernelVariant &variant = variants[v];
+        if (onlyKernel != NULL && strcmp(onlyKernel, variant.kernel) != 0) { continue; }
+        
+        // Warm up on one pass over the batch, then time
+        variant.func(batch, batchSize);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        double checksum = variant.func(batch, calls);
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        
+        double nanos = elapsed.count() / calls;
+        bool baseline = v == 0 || strcmp(variants[v-1].kernel, variant.kernel) != 0;
+        if (baseline) {
+            baselineNanos = nanos;
+            baselineChecksum = checksum;
+        }
+        double speedup = baselineNanos / nanos;
+        double achieved = variant.countsHits ? checksum / calls : -1;
+        // Relative difference from the scalar result, so a fast but wrong variant shows up
+        double error = fabs(checksum - baselineChecksum) / std::max(fabs(baselineChecksum), 1e-30);
+        bool mismatch = !(error <= checksumTolerance);
+        if (mismatch) { mismatches++; }
+        
+        char hitRateText[16] = "-";
+        if (variant.countsHits) { snprintf(hitRateText, sizeof(hitRateText), "%.3f", achieved); }
+        char errorText[16] = "-";
+        if (!baseline) { snprintf(errorText, sizeof(errorText), "%.2e", error); }
+        
+        if (json) {
+            printf("%s  {\"kernel\": \"%s\", \"variant\": \"%s\", \"ns_per_call\": %.3f, \"mcalls_per_s\": %.3f, \"speedup\": %.3f, \"checksum\": %.17g",
+                   first ? "" : ",\n", variant.kernel, variant.variant, nanos, 1e3 / nanos, speedup, checksum);
+            if (variant.countsHits) { printf(", \"hit_rate\": %.4f", achieved); }
+            if (!baseline) { printf(", \"checksum_error\": %.3e, \"matches\": %s", error, mismatch ? "false" : "true"); }
+            printf("}");
+        } else {
+            printf("%-18s %-10s %10.2f %12.2f %9.2fx %10s %10s%s\n", variant.kernel, variant.variant, nanos, 1e3 / nanos, speedup,
+                   hitRateText, errorText, mismatch ? "  MISMATCH" : "");
+        }
+        first = false;
+    }
+    if (json) { printf("\n]}\n"); }
+    if (mismatches > 0) {
+        fprintf(stderr, "%d variant(s) differ from their scalar baseline by more than %g\n", mismatches, checksumTolerance);
+        return 1;
+    }
+}
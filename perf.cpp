@@ -0,0 +1,136 @@
+//
+//  perf.cpp
+//  
+//
+
+#include <string.h>
+#include "perf.hpp"
+
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+const char* perfCounterNames[NUM_PERF_COUNTERS] = {
+    "cycles", "instructions", "llc_misses", "branch_misses"
+};
+
+bool perfEnabled = false;
+bool perfCounterAvailable[NUM_PERF_COUNTERS] = { false };
+bool perfStagesEnabled = false;
+
+#ifdef __linux__
+
+static const unsigned long long perfConfigs[NUM_PERF_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+// The calling thread's counter group: the first counter that opened leads it,
+// so all of them are scheduled onto the PMU together and read in one call
+struct PerfGroup {
+    bool opened;
+    int leader;
+    int fds[NUM_PERF_COUNTERS];
+    // Position of each counter in the group read, or -1
+    int slots[NUM_PERF_COUNTERS];
+    int size;
+    
+    PerfGroup() : opened(false), leader(-1), size(0) {
+        for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+            fds[c] = -1;
+            slots[c] = -1;
+        }
+    }
+    
+    // Runs as the thread exits, so worker threads do not leak their counters
+    ~PerfGroup() {
+        for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+            if (fds[c] != -1) { close(fds[c]); }
+        }
+    }
+};
+
+static thread_local PerfGroup threadGroup;
+
+static int openCounter( PerfCounter counter, int leader ) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = perfConfigs[counter];
+    attr.disabled = leader == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+static int openGroup( PerfGroup &group ) {
+    group.opened = true;
+    group.leader = -1;
+    group.size = 0;
+    int firstError = 0;
+    for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+        group.fds[c] = openCounter((PerfCounter)c, group.leader);
+        group.slots[c] = -1;
+        if (group.fds[c] == -1) {
+            if (firstError == 0) { firstError = errno; }
+            continue;
+        }
+        if (group.leader == -1) { group.leader = group.fds[c]; }
+        group.slots[c] = group.size++;
+    }
+    if (group.leader != -1) {
+        ioctl(group.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(group.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    return firstError;
+}
+
+bool openPerfCounters( std::string &error ) {
+    int firstError = openGroup(threadGroup);
+    if (threadGroup.leader == -1) {
+        error = strerror(firstError);
+        if (firstError == ENOENT || firstError == EOPNOTSUPP) {
+            error += " (no hardware counters, which is usual inside virtual machines)";
+        } else if (firstError == EACCES || firstError == EPERM) {
+            error += " (check /proc/sys/kernel/perf_event_paranoid)";
+        }
+        return false;
+    }
+    for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+        perfCounterAvailable[c] = threadGroup.slots[c] != -1;
+    }
+    perfEnabled = true;
+    return true;
+}
+
+void readPerfCounters( unsigned long long counts[] ) {
+    memset(counts, 0, NUM_PERF_COUNTERS * sizeof(unsigned long long));
+    if (!threadGroup.opened) { openGroup(threadGroup); }
+    if (threadGroup.leader == -1) { return; }
+    
+    // nr, time enabled, time running, then one value per counter
+    unsigned long long buffer[3 + NUM_PERF_COUNTERS];
+    if (read(threadGroup.leader, buffer, sizeof(buffer)) < (ssize_t)((3 + threadGroup.size) * sizeof(unsigned long long))) { return; }
+    double scale = buffer[2] > 0 ? (double)buffer[1] / buffer[2] : 0;
+    for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+        if (threadGroup.slots[c] != -1) { counts[c] = buffer[3 + threadGroup.slots[c]] * scale; }
+    }
+}
+
+#else
+
+bool openPerfCounters( std::string &error ) {
+    error = "hardware counters are only read on Linux";
+    return false;
+}
+
+void readPerfCounters( unsigned long long counts[] ) {
+    memset(counts, 0, NUM_PERF_COUNTERS * sizeof(unsigned long long));
+}
+
+#endif
@@ -0,0 +1,42 @@
+//
+//  perf.hpp
+//  
+//
+
+#ifndef perf_hpp
+#define perf_hpp
+
+#include <string>
+
+// Hardware performance counters read through Linux perf_event_open
+// Only user space events of the calling thread are counted. Each thread opens
+// its own counter group the first time it reads it
+// On other platforms openPerfCounters() always fails
+
+enum PerfCounter {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    NUM_PERF_COUNTERS
+};
+
+extern const char* perfCounterNames[NUM_PERF_COUNTERS];
+
+// Set by openPerfCounters(). Counters the CPU or kernel does not provide stay
+// unavailable and read as 0
+extern bool perfEnabled;
+extern bool perfCounterAvailable[NUM_PERF_COUNTERS];
+// Also count the fine grained stages (ray generation, traversal, shading).
+// Every timed call then makes two read() system calls, which slows the render
+// and adds the read wrappers' own user space work to the counts
+extern bool perfStagesEnabled;
+
+// Opens the calling thread's counters and enables counting
+// Returns false with the reason in error if no counter could be opened
+bool openPerfCounters( std::string &error );
+// Current counts for the calling thread, scaled up if the kernel had to
+// multiplex the counters
+void readPerfCounters( unsigned long long counts[] );
+
+#endif /* perf_hpp */
@@ -0,0 +1,461 @@
+//
+//  render.cpp
+//  
+//
+
+#include <iostream>
+#include <limits>
+#include <chrono>
+#include "render.hpp"
+#include "stats.hpp"
+#include "capture.hpp"
+
+const char* aovNames[NUM_AOVS] = { "depth", "normal", "albedo", "id", "cost", "tests" };
+const int aovChannels[NUM_AOVS] = { 1, 3, 3, 1, 1, 1 };
+
+Scene::Scene() {
+    Camera camera = { vec3(0,5,0), vec3(0,-1,0), 1 };
+    cam = camera;
+    addMaterial(Material());
+}
+
+int Scene::numObjects() const {
+    return spheres.size() + meshes.size();
+}
+
+MaterialId Scene::addMaterial( const Material &material ) {
+    std::map<Material, MaterialId>::iterator found = materialIds.find(material);
+    if (found != materialIds.end()) { return found->second; }
+    MaterialId id = materials.size();
+    materials.push_back(material);
+    materialIds[material] = id;
+    return id;
+}
+
+const Material& Scene::objectMaterial( int obj ) const {
+    if (obj < (int)spheres.size()) { return materials[spheres[obj].getMaterial()]; }
+    return materials[meshes[obj - spheres.size()].getMaterial()];
+}
+
+// 64-bit FNV-1a over the bit patterns of the values
+static void hashBytes( uint64_t &hash, const void* data, size_t size ) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+}
+
+static void hashVec( uint64_t &hash, vec3 v ) {
+    float values[3] = { v.x, v.y, v.z };
+    hashBytes(hash, values, sizeof(values));
+}
+
+static void hashMaterial( uint64_t &hash, const Material &material ) {
+    float exponent = material.getPhongExp();
+    hashVec(hash, material.getDiffuse());
+    hashVec(hash, material.getSpecular());
+    hashBytes(hash, &exponent, sizeof(exponent));
+    hashVec(hash, material.getReflectance());
+}
+
+// Objects are hashed with their materials rather than material IDs, so the
+// order materials were added in does not matter
+uint64_t Scene::hash() const {
+    uint64_t hash = 14695981039346656037ull;
+    uint32_t counts[3] = { (uint32_t)lights.size(), (uint32_t)spheres.size(), (uint32_t)meshes.size() };
+    hashBytes(hash, counts, sizeof(counts));
+    hashVec(hash, cam.position);
+    hashVec(hash, cam.direction);
+    hashBytes(hash, &cam.focalLength, sizeof(cam.focalLength));
+    for (size_t i = 0; i < lights.size(); i++) {
+        hashVec(hash, lights[i].position);
+        hashVec(hash, lights[i].intensity);
+    }
+    for (size_t i = 0; i < spheres.size(); i++) {
+        float radius = spheres[i].getRadius();
+        hashVec(hash, spheres[i].getPosition());
+        hashBytes(hash, &radius, sizeof(radius));
+        hashMaterial(hash, materials[spheres[i].getMaterial()]);
+    }
+    for (size_t i = 0; i < meshes.size(); i++) {
+        for (int v = 0; v < 3; v++) { hashVec(hash, meshes[i].getVertex(v)); }
+        hashMaterial(hash, materials[meshes[i].getMaterial()]);
+    }
+    return hash;
+}
+
+RenderSettings::RenderSettings() {
+    width = 500;
+    height = 500;
+    viewHeight = 5;
+    maxDepth = 2;
+    samplesPerPixel = 1;
+    seed = 0;
+    for (int aov = 0; aov < NUM_AOVS; aov++) { aovEnabled[aov] = false; }
+}
+
+bool RenderSettings::anyAOV() const {
+    for (int aov = 0; aov < NUM_AOVS; aov++) {
+        if (aovEnabled[aov]) { return true; }
+    }
+    return false;
+}
+
+RayBound::RayBound() : empty(true), originLower(0.0f), originUpper(0.0f), directionLower(0.0f), directionUpper(0.0f),
+    segmentLower(0.0f), segmentUpper(0.0f), length(0.0f) {}
+
+void RayBound::add( vec3 origin, vec3 direction, float segmentLength ) {
+    vec3 unit = glm::normalize(direction);
+    vec3 end = origin + unit * glm::min(segmentLength, std::numeric_limits<float>::max());
+    if (empty) {
+        empty = false;
+        originLower = originUpper = origin;
+        directionLower = directionUpper = unit;
+        segmentLower = glm::min(origin, end);
+        segmentUpper = glm::max(origin, end);
+        length = segmentLength;
+        return;
+    }
+    originLower = glm::min(originLower, origin);
+    originUpper = glm::max(originUpper, origin);
+    directionLower = glm::min(directionLower, unit);
+    directionUpper = glm::max(directionUpper, unit);
+    segmentLower = glm::min(segmentLower, glm::min(origin, end));
+    segmentUpper = glm::max(segmentUpper, glm::max(origin, end));
+    length = glm::max(length, segmentLength);
+}
+
+RayBound RayBound::reversed() const {
+    RayBound bound = *this;
+    bound.directionLower = -directionUpper;
+    bound.directionUpper = -directionLower;
+    bound.length = std::numeric_limits<float>::infinity();
+    return bound;
+}
+
+// The directions lie in a cone around the middle of their box, no wider than
+// the box's farthest corner; the box's corners span it, so a cone of up to 90
+// degrees holding them holds the box. Moving each segment's start to the
+// middle of the start box moves every point of it by at most the box's half
+// diagonal, so the sphere grown by that much meets the cone from there
+// whenever the original sphere meets a segment
+bool RayBound::meets( vec3 center, float radius ) const {
+    if (empty) { return false; }
+    if (length < std::numeric_limits<float>::infinity() &&
+        (glm::any(glm::greaterThan(segmentLower - center, vec3(radius))) || glm::any(glm::greaterThan(center - segmentUpper, vec3(radius))))) {
+        return false;
+    }
+    
+    vec3 apex = (originLower + originUpper) * 0.5f;
+    float reach = radius + glm::length(originUpper - originLower) * 0.5f;
+    vec3 toCenter = center - apex;
+    float distance = glm::length(toCenter);
+    if (distance <= reach) { return true; }
+    if (distance - reach > length) { return false; }
+    
+    vec3 middle = (directionLower + directionUpper) * 0.5f;
+    if (glm::length(middle) < 1e-6f) { return true; }
+    vec3 axis = glm::normalize(middle);
+    float cosAngle = 1.0f;
+    for (int corner = 0; corner < 8; corner++) {
+        vec3 direction((corner & 1) ? directionUpper.x : directionLower.x, (corner & 2) ? directionUpper.y : directionLower.y,
+                       (corner & 4) ? directionUpper.z : directionLower.z);
+        if (glm::length(direction) < 1e-6f) { return true; }
+        cosAngle = glm::min(cosAngle, glm::dot(axis, direction) / glm::length(direction));
+    }
+    if (cosAngle <= 0) { return true; }
+    
+    // Compare angles from the axis, with some slack for rounding
+    float centerAngle = acosf(glm::clamp(glm::dot(toCenter, axis) / distance, -1.0f, 1.0f));
+    float sphereAngle = asinf(reach / distance);
+    return centerAngle <= acosf(cosAngle) + sphereAngle + 1e-3f;
+}
+
+void TileRecord::clear( const Scene &scene ) {
+    hitObjects.assign(scene.numObjects(), false);
+    litBy.assign(scene.lights.size(), false);
+    contributedBy.assign(scene.lights.size(), false);
+    cameraRays = RayBound();
+    reflectionRays = RayBound();
+    shadowRays.assign(scene.lights.size(), RayBound());
+    reflectionShadowRays.assign(scene.lights.size(), RayBound());
+}
+
+// The record renderPixelsRecorded() is filling on this thread, if any
+static thread_local TileRecord* tileRecord = NULL;
+// Where shade() records its shadow rays: tileRecord's for camera ray hits or
+// for reflection ray hits
+static thread_local std::vector<RayBound>* shadowRecord = NULL;
+
+static unsigned int hash( unsigned int x ) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+// Random number in [0,1) that depends only on the seed and its arguments,
+// so any sample can be regenerated exactly without stored generator state
+float sampleRandom( unsigned int seed, int x, int y, int sample, int dim ) {
+    unsigned int h = hash(seed ^ hash(x ^ hash(y ^ hash(sample*2 + dim))));
+    return (h >> 8) * (1.0f / 16777216.0f);
+}
+
+// (dx,dy) is the sample position inside the pixel
+Ray genCameraRay( const Scene &scene, const RenderSettings &settings, int xCoor, int yCoor, double dx, double dy ) {
+    const Camera &cam = scene.cam;
+    float screenWidth = settings.width;
+    float screenHeight = settings.height;
+    float viewHeight = settings.viewHeight;
+    float worldHeight = viewHeight;
+    float worldWidth = viewHeight * screenWidth / screenHeight;
+    
+    vec3 right = glm::normalize( glm::cross( cam.direction, vec3(0.0,0.0,1.0) ) );
+    vec3 up = glm::normalize( glm::cross( right, cam.direction ) );
+    
+    float u = (-worldWidth/2) + worldWidth*(xCoor+dx)/screenWidth;
+    float v = (-worldHeight/2) + worldHeight*(yCoor+dy)/screenHeight;
+    
+    Ray camRay;
+    camRay.origin = cam.position;
+    // FreeImage begins at the lower left corner
+    camRay.path = (cam.focalLength * glm::normalize(cam.direction)) + (u*right) + (v*up);
+    
+    return camRay;
+}
+
+// Find the closest object hit by the ray between minTime and maxTime; returns -1 if nothing is hit
+int closestHit( const Scene &scene, Ray ray, vec3 &location, vec3 &normal, float &time, float minTime, float maxTime ) {
+    STAT_TIMER(STAT_TRAVERSAL);
+    const std::vector<Sphere> &spheres = scene.spheres;
+    const std::vector<Mesh> &meshes = scene.meshes;
+    time = maxTime;
+    int closestObj = -1;
+    
+    // Loop over every object
+    // If the current object is intersected and closer than the previous object
+    for (size_t obj = 0; obj < spheres.size(); obj++) {
+        if (spheres[obj].intersects(ray, location, normal, time, minTime, time)) {
+            closestObj = obj;
+        }
+    }
+    for (size_t obj = 0; obj < meshes.size(); obj++) {
+        if (meshes[obj].intersects(ray, location, normal, time, minTime, time)) {
+            closestObj = spheres.size() + obj;
+        }
+    }
+    return closestObj;
+}
+
+// Test whether any object blocks the ray
+bool occluded( const Scene &scene, Ray ray, float minTime, float maxTime ) {
+    STAT_TIMER(STAT_TRAVERSAL);
+    const std::vector<Sphere> &spheres = scene.spheres;
+    const std::vector<Mesh> &meshes = scene.meshes;
+    // Dummy variable to pass to the intersects function in place of time
+    float dummy;
+    
+    for (size_t obj = 0; obj < spheres.size(); obj++) {
+        if (spheres[obj].intersects(ray, dummy, minTime, maxTime)) { return true; }
+    }
+    for (size_t obj = 0; obj < meshes.size(); obj++) {
+        if (meshes[obj].intersects(ray, dummy, minTime, maxTime)) { return true; }
+    }
+    return false;
+}
+
+// Direct lighting at a hit point, including the ambient term
+vec3 shade( const Scene &scene, int obj, vec3 location, vec3 normal ) {
+    const std::vector<Light> &lights = scene.lights;
+    const Material &material = scene.objectMaterial(obj);
+    // Ambient term
+    vec3 color = vec3(0.1f);
+    
+    // Loop over every light in the scene
+    for (size_t i = 0; i < lights.size(); i++) {
+        vec3 lightDir = glm::normalize(lights[i].position-location);
+        
+        //Test to see if any object blocks the light
+        Ray shadowRay = {location,lightDir};
+        STAT_COUNT(STAT_SHADOW_RAYS);
+        if (rayCaptureEnabled) { captureRay(shadowRay, 0.01, std::numeric_limits<float>::infinity(), RAY_SHADOW); }
+        bool inShadow = occluded(scene, shadowRay, 0.01, std::numeric_limits<float>::infinity());
+        if (tileRecord != NULL) {
+            tileRecord->litBy[i] = true;
+            tileRecord->contributedBy[i] = tileRecord->contributedBy[i] || !inShadow;
+            (*shadowRecord)[i].add(lights[i].position, location - lights[i].position, glm::length(location - lights[i].position));
+        }
+        
+        // If the object is not in shadow, calculate the lighting
+        if (inShadow == false) {
+            STAT_COUNT(STAT_SHADING_CALLS);
+            STAT_TIMER(STAT_SHADING);
+            color += material.calcShading(normal, lights[i], lightDir);
+        }
+    }
+    return color;
+}
+
+void initPath( PathState &path, Ray ray ) {
+    path.ray = ray;
+    path.throughput = vec3(1.0f);
+    path.color = vec3(0.0f);
+    path.depth = 0;
+}
+
+// Trace one segment of a path and spawn its reflection ray
+// If aov is given, the first segment's hit is recorded in it
+// Returns false once the path has terminated
+bool tracePath( const Scene &scene, const RenderSettings &settings, PathState &path, AOVSample *aov ) {
+    int maxDepth = settings.maxDepth;
+
+    // Exit Condition
+    if (path.depth >= maxDepth) { return false; }
+    
+    vec3 location = vec3(0,0,0);
+    vec3 normal = vec3(0,0,0);
+    float time;
+    if (rayCaptureEnabled) {
+        captureRay(path.ray, 0.001, std::numeric_limits<float>::infinity(), path.depth == 0 ? RAY_PRIMARY : RAY_REFLECTION);
+    }
+    int closestObj = closestHit(scene, path.ray, location, normal, time);
+    if (path.depth == 0) {
+        STAT_COUNT(STAT_PRIMARY_RAYS);
+    } else {
+        STAT_COUNT(STAT_REFLECTION_RAYS);
+    }
+    if (tileRecord != NULL) {
+        float length = closestObj == -1 ? std::numeric_limits<float>::infinity() : time * glm::length(path.ray.path);
+        RayBound &bound = path.depth == 0 ? tileRecord->cameraRays : tileRecord->reflectionRays;
+        bound.add(path.ray.origin, path.ray.path, length);
+        if (closestObj != -1) { tileRecord->hitObjects[closestObj] = true; }
+        shadowRecord = path.depth == 0 ? &tileRecord->shadowRays : &tileRecord->reflectionShadowRays;
+    }
+    
+    if (aov != NULL && path.depth == 0) {
+        aov->object = closestObj;
+        if (closestObj != -1) {
+            aov->distance = time * glm::length(path.ray.path);
+            aov->position = location;
+            aov->normal = normal;
+            aov->albedo = scene.objectMaterial(closestObj).getDiffuse();
+        } else {
+            aov->distance = std::numeric_limits<float>::infinity();
+            aov->position = vec3(0.0f);
+            aov->normal = vec3(0.0f);
+            aov->albedo = vec3(0.0f);
+        }
+    }
+    
+    if (closestObj == -1) {
+        path.depth = maxDepth;
+        return false;
+    }
+    
+    path.color += path.throughput * shade(scene, closestObj, location, normal);
+    path.throughput *= scene.objectMaterial(closestObj).getReflectance();
+    path.depth++;
+    
+    // Paths that can no longer contribute stop early
+    if (path.throughput == vec3(0.0f)) {
+        path.depth = maxDepth;
+        return false;
+    }
+    
+    // Calculate reflection ray
+    path.ray.origin = location;
+    vec3 dir = glm::normalize(path.ray.path);
+    path.ray.path = dir - 2*(glm::dot(dir,normal))*normal;
+    
+    return path.depth < maxDepth;
+}
+
+// Function is called once per view ray
+vec3 raytrace( const Scene &scene, const RenderSettings &settings, Ray ray, AOVSample *aov ) {
+    PathState path;
+    initPath(path, ray);
+    while (tracePath(scene, settings, path, aov)) {}
+    return path.color;
+}
+
+// A single sample goes through the pixel centre, several are jittered
+vec3 renderSample( const Scene &scene, const RenderSettings &settings, int x, int y, int sample, AOVSample *aov ) {
+    double dx = 0.5, dy = 0.5;
+    if (settings.samplesPerPixel > 1) {
+        dx = sampleRandom(settings.seed, x, y, sample, 0);
+        dy = sampleRandom(settings.seed, x, y, sample, 1);
+    }
+    Ray ray;
+    {
+        STAT_TIMER(STAT_RAY_GENERATION);
+        ray = genCameraRay(scene, settings, x, y, dx, dy);
+    }
+    return raytrace( scene, settings, ray, aov );
+}
+
+// All camera samples of one pixel, averaged
+// If aov is given, it records the first sample's traversal
+vec3 renderPixel( const Scene &scene, const RenderSettings &settings, int x, int y, AOVSample *aov ) {
+    vec3 color = vec3(0.0f);
+    for (int s = 0; s < settings.samplesPerPixel; s++) {
+        color += renderSample( scene, settings, x, y, s, s == 0 ? aov : NULL );
+    }
+    return color / (float)settings.samplesPerPixel;
+}
+
+// Render the tile with its lower left corner at (x0,y0) into tile sized buffers
+void renderTile( const Scene &scene, const RenderSettings &settings, int x0, int y0, int tileSize, Framebuffer &tile, Framebuffer aovTiles[] ) {
+    int width = glm::min(tileSize, settings.width - x0);
+    int height = glm::min(tileSize, settings.height - y0);
+    const bool* aovEnabled = settings.aovEnabled;
+    bool anyAOV = settings.anyAOV();
+    tile.resize(width, height);
+    for (int aov = 0; aov < NUM_AOVS; aov++) {
+        if (aovEnabled[aov]) { aovTiles[aov].resize(width, height, aovChannels[aov]); }
+    }
+    
+    for (int i = 0; i < width; i++) {
+        for (int j = 0; j < height; j++) {
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            unsigned long long testsBefore = primitiveTests();
+            
+            AOVSample sample;
+            tile.set( i, j, renderPixel(scene, settings, x0+i, y0+j, anyAOV ? &sample : NULL) );
+            
+            if (!anyAOV) { continue; }
+            std::chrono::duration<float, std::micro> cost = std::chrono::high_resolution_clock::now() - start;
+            
+            if (aovEnabled[AOV_DEPTH]) { aovTiles[AOV_DEPTH].setValue(i, j, sample.distance); }
+            if (aovEnabled[AOV_NORMAL]) { aovTiles[AOV_NORMAL].set(i, j, sample.normal); }
+            if (aovEnabled[AOV_ALBEDO]) { aovTiles[AOV_ALBEDO].set(i, j, sample.albedo / 255.0f); }
+            if (aovEnabled[AOV_ID]) { aovTiles[AOV_ID].setValue(i, j, sample.object); }
+            if (aovEnabled[AOV_COST]) { aovTiles[AOV_COST].setValue(i, j, cost.count()); }
+            if (aovEnabled[AOV_TESTS]) { aovTiles[AOV_TESTS].setValue(i, j, primitiveTests() - testsBefore); }
+        }
+    }
+    
+    if (rayCaptureEnabled) { flushRayCapture(); }
+}
+
+void renderPixels( const Scene &scene, const RenderSettings &settings, int x0, int y0, int width, int height, float* pixels, size_t rowStride ) {
+    for (int j = 0; j < height; j++) {
+        float* row = pixels + j * rowStride;
+        for (int i = 0; i < width; i++) {
+            vec3 color = renderPixel(scene, settings, x0+i, y0+j, NULL);
+            row[3*i] = color.x;
+            row[3*i + 1] = color.y;
+            row[3*i + 2] = color.z;
+        }
+    }
+    
+    if (rayCaptureEnabled) { flushRayCapture(); }
+}
+
+void renderPixelsRecorded( const Scene &scene, const RenderSettings &settings, int x0, int y0, int width, int height, float* pixels, size_t rowStride, TileRecord &record ) {
+    record.clear(scene);
+    tileRecord = &record;
+    renderPixels(scene, settings, x0, y0, width, height, pixels, rowStride);
+    tileRecord = NULL;
+}
@@ -0,0 +1,135 @@
+//
+//  render.hpp
+//  
+//
+
+#ifndef render_hpp
+#define render_hpp
+
+#include <stdio.h>
+#include <stddef.h>
+#include <vector>
+#include <map>
+#include <limits>
+#include "geometry.hpp"
+#include "framebuffer.hpp"
+
+// The rendering engine, built as libraytracer.a
+// It keeps no state of its own: every call takes the scene and settings it
+// works on, so separate scenes can be rendered concurrently on separate
+// threads. Statistics are per thread; ray capture is process wide
+
+// Auxiliary outputs that can be written alongside the beauty image
+enum AOV { AOV_DEPTH, AOV_NORMAL, AOV_ALBEDO, AOV_ID, AOV_COST, AOV_TESTS, NUM_AOVS };
+extern const char* aovNames[NUM_AOVS];
+extern const int aovChannels[NUM_AOVS];
+
+// Object indices run over the spheres first, then the meshes
+struct Scene {
+    std::vector<Light> lights;
+    Camera cam;
+    std::vector<Sphere> spheres;
+    std::vector<Mesh> meshes;
+    // Materials shared by the spheres and meshes, each stored once; entry 0
+    // is the black default new objects start with
+    std::vector<Material> materials;
+    // Where each material is in the table, for addMaterial
+    std::map<Material, MaterialId> materialIds;
+    
+    Scene();
+    int numObjects() const;
+    // ID of material in the table, adding it if it is not there yet
+    MaterialId addMaterial(const Material &material);
+    const Material& objectMaterial(int obj) const;
+    // Fingerprint of the camera, lights, objects and their materials, so a
+    // render split across runs or machines can check it has the same scene
+    uint64_t hash() const;
+};
+
+struct RenderSettings {
+    // Image size in pixels
+    int width;
+    int height;
+    // Height of the image plane in world units; the width follows the aspect ratio
+    float viewHeight;
+    // Number of ray segments traced per camera ray (the camera ray plus its reflections)
+    int maxDepth;
+    // Camera samples per pixel; a single sample goes through the pixel center
+    int samplesPerPixel;
+    unsigned int seed;
+    bool aovEnabled[NUM_AOVS];
+    
+    // 500x500, depth 2, one sample, no AOVs
+    RenderSettings();
+    bool anyAOV() const;
+};
+
+// Conservative bound of a set of ray segments, in a fixed size: the boxes
+// their starts and their unit directions fall in, their greatest length and,
+// while none is endless, the box around the whole segments
+struct RayBound {
+    bool empty;
+    vec3 originLower;
+    vec3 originUpper;
+    vec3 directionLower;
+    vec3 directionUpper;
+    vec3 segmentLower;
+    vec3 segmentUpper;
+    float length;
+    
+    RayBound();
+    // direction need not be unit length; length is infinite for misses
+    void add(vec3 origin, vec3 direction, float length);
+    // The same segments continued past their starts, backwards and without
+    // end: for rays that run on through the point they are bounded from
+    RayBound reversed() const;
+    // Whether a segment of the set may pass within radius of center
+    bool meets(vec3 center, float radius) const;
+};
+
+// What the rays of one region touched, so that after an edit only the
+// regions the edit can change need rendering again (see incremental.hpp)
+// Its size depends on the scene's object and light counts, not on how many
+// rays the region cast
+struct TileRecord {
+    // Objects hit by a camera or reflection ray
+    std::vector<bool> hitObjects;
+    // Lights evaluated at a hit, and lights that reached a hit unblocked
+    std::vector<bool> litBy;
+    std::vector<bool> contributedBy;
+    // The camera rays, up to their hits, and the reflection rays
+    RayBound cameraRays;
+    RayBound reflectionRays;
+    // Per light, the shadow rays from camera ray hits and from reflection ray
+    // hits, seen from the light: they run from the light back to their hits.
+    // Shadow rays are not cut off at the light, so each also runs on from the
+    // light the other way, without end
+    std::vector<RayBound> shadowRays;
+    std::vector<RayBound> reflectionShadowRays;
+    
+    // Empties the record and sizes it for scene
+    void clear(const Scene &scene);
+};
+
+float sampleRandom( unsigned int seed, int x, int y, int sample, int dim );
+Ray genCameraRay( const Scene &scene, const RenderSettings &settings, int xCoor, int yCoor, double dx = 0.5, double dy = 0.5 );
+int closestHit( const Scene &scene, Ray ray, vec3 &location, vec3 &normal, float &time, float minTime = 0.001, float maxTime = std::numeric_limits<float>::infinity() );
+bool occluded( const Scene &scene, Ray ray, float minTime, float maxTime );
+vec3 shade( const Scene &scene, int obj, vec3 location, vec3 normal );
+void initPath( PathState &path, Ray ray );
+bool tracePath( const Scene &scene, const RenderSettings &settings, PathState &path, AOVSample *aov = NULL );
+vec3 raytrace( const Scene &scene, const RenderSettings &settings, Ray ray, AOVSample *aov = NULL );
+// Camera sample number sample of pixel (x,y), one of settings.samplesPerPixel
+vec3 renderSample( const Scene &scene, const RenderSettings &settings, int x, int y, int sample, AOVSample *aov = NULL );
+// All camera samples of pixel (x,y), averaged; aov records the first sample's first hit
+vec3 renderPixel( const Scene &scene, const RenderSettings &settings, int x, int y, AOVSample *aov = NULL );
+void renderTile( const Scene &scene, const RenderSettings &settings, int x0, int y0, int tileSize, Framebuffer &tile, Framebuffer aovTiles[] );
+
+// Renders the width x height pixels with their lower left corner at (x0,y0)
+// straight into a caller owned buffer of RGB floats on the 0-255 scale
+// pixels points at (x0,y0); rows go upwards and start rowStride floats apart
+void renderPixels( const Scene &scene, const RenderSettings &settings, int x0, int y0, int width, int height, float* pixels, size_t rowStride );
+// renderPixels that also records what its rays touched; record is cleared first
+void renderPixelsRecorded( const Scene &scene, const RenderSettings &settings, int x0, int y0, int width, int height, float* pixels, size_t rowStride, TileRecord &record );
+
+#endif /* render_hpp */
@@ -0,0 +1,120 @@
+//
+//  replay.cpp
+//  
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include "render.hpp"
+#include "capture.hpp"
+
+// Streams a ray capture (raytracer --capture) through the intersection engine
+// alone: closest hit queries for primary and reflection rays, any hit queries
+// for shadow rays. No shading is done, so timings isolate traversal
+// The hit counts and summed hit times act as a checksum when comparing engines
+
+int main(int argc, char* argv[]) {
+    const char* captureFile = NULL;
+    int batchSize = 65536;
+    int onlyType = -1;
+    bool json = false;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--type") == 0 && i+1 < argc) {
+            i++;
+            onlyType = 0;
+            while (onlyType < NUM_RAY_TYPES && strcmp(argv[i], rayTypeNames[onlyType]) != 0) { onlyType++; }
+            if (onlyType == NUM_RAY_TYPES) {
+                std::cerr << "Unknown ray type " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--batch") == 0 && i+1 < argc) {
+            batchSize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else {
+            captureFile = argv[i];
+        }
+    }
+    if (captureFile == NULL) {
+        std::cerr << "Usage: replay CAPTURE [--type primary|shadow|reflection] [--batch N] [--json]" << std::endl;
+        return 1;
+    }
+    
+    Scene scene;
+    RayCaptureReader reader;
+    if (!reader.open(captureFile, scene.spheres, scene.meshes)) {
+        std::cerr << "Could not read " << captureFile << std::endl;
+        return 1;
+    }
+    
+    unsigned long long rays[NUM_RAY_TYPES] = { 0 };
+    unsigned long long hits[NUM_RAY_TYPES] = { 0 };
+    double hitTimes[NUM_RAY_TYPES] = { 0 };
+    double seconds[NUM_RAY_TYPES] = { 0 };
+    
+    // Rays are read in batches and split by type outside the timed region;
+    // each type's run is then timed as a whole, since reading the clock per
+    // ray would cost about as much as a query against a small scene
+    std::vector<CapturedRay> batch;
+    std::vector<CapturedRay> byType[NUM_RAY_TYPES];
+    int count;
+    while ((count = reader.read(batch, batchSize)) > 0) {
+        for (int type = 0; type < NUM_RAY_TYPES; type++) { byType[type].clear(); }
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (onlyType >= 0 && batch[i].type != onlyType) { continue; }
+            byType[batch[i].type].push_back(batch[i]);
+        }
+        
+        for (int type = 0; type < NUM_RAY_TYPES; type++) {
+            std::vector<CapturedRay> &run = byType[type];
+            if (run.empty()) { continue; }
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < run.size(); i++) {
+                CapturedRay &captured = run[i];
+                bool hit;
+                float time = 0;
+                if (type == RAY_SHADOW) {
+                    hit = occluded(scene, captured.ray, captured.minTime, captured.maxTime);
+                } else {
+                    vec3 location, normal;
+                    hit = closestHit(scene, captured.ray, location, normal, time, captured.minTime, captured.maxTime) != -1;
+                }
+                if (hit) {
+                    hits[type]++;
+                    hitTimes[type] += time;
+                }
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            
+            rays[type] += run.size();
+            seconds[type] += elapsed.count();
+        }
+    }
+    
+    if (count < 0) {
+        std::cerr << captureFile << " is not a valid capture: it is truncated or holds an unknown ray type" << std::endl;
+        return 1;
+    }
+    
+    if (json) {
+        printf("{\"capture\": \"%s\", \"spheres\": %d, \"triangles\": %d, \"results\": [\n", captureFile, (int)scene.spheres.size(), (int)scene.meshes.size());
+    } else {
+        printf("%d spheres, %d triangles, %llu rays\n", (int)scene.spheres.size(), (int)scene.meshes.size(), reader.getNumRays());
+        printf("%-12s %12s %12s %12s %10s %16s\n", "type", "rays", "hits", "seconds", "Mrays/s", "hit time sum");
+    }
+    for (int type = 0; type < NUM_RAY_TYPES; type++) {
+        double rate = seconds[type] > 0 ? rays[type] / seconds[type] / 1e6 : 0;
+        if (json) {
+            printf("%s  {\"type\": \"%s\", \"rays\": %llu, \"hits\": %llu, \"seconds\": %.6f, \"mrays_per_s\": %.4f, \"hit_time_sum\": %.6f}",
+                   type ? ",\n" : "", rayTypeNames[type], rays[type], hits[type], seconds[type], rate, hitTimes[type]);
+        } else {
+            printf("%-12s %12llu %12llu %12.6f %10.4f %16.6f\n", rayTypeNames[type], rays[type], hits[type], seconds[type], rate, hitTimes[type]);
+        }
+    }
+    if (json) { printf("\n]}\n"); }
+}
@@ -0,0 +1,194 @@
+//
+//  reproject.cpp
+//  
+//
+
+#include <math.h>
+#include <limits>
+#include <algorithm>
+#include "reproject.hpp"
+#include "arena.hpp"
+
+// Frames a pixel may be carried forward before it is traced again, so
+// small reprojection errors cannot pile up
+static const int maxReuseAge = 8;
+// How much further than its nearest neighbour a reused hit may be
+static const float neighbourDepthTolerance = 1.05f;
+
+// Bounding sphere of an object that moved, in one of its two poses
+struct MovedBound {
+    vec3 center;
+    float radius;
+};
+
+ReprojectionCache::ReprojectionCache(float maxDegrees) : minConfidence(cosf(glm::radians(maxDegrees))), valid(false), width(0), height(0) {}
+
+// The inverse of genCameraRay: continuous pixel coordinates of a point in
+// front of the camera, with pixel (x,y) covering [x,x+1) x [y,y+1)
+static bool project( const Camera &cam, const RenderSettings &settings, vec3 point, float &px, float &py ) {
+    vec3 forward = glm::normalize(cam.direction);
+    vec3 right = glm::normalize( glm::cross( cam.direction, vec3(0.0,0.0,1.0) ) );
+    vec3 up = glm::normalize( glm::cross( right, cam.direction ) );
+    vec3 offset = point - cam.position;
+    float along = glm::dot(offset, forward);
+    if (along <= 0) { return false; }
+    
+    float scale = cam.focalLength / along;
+    float worldHeight = settings.viewHeight;
+    float worldWidth = settings.viewHeight * settings.width / settings.height;
+    px = (scale * glm::dot(offset, right) + worldWidth/2) * settings.width / worldWidth;
+    py = (scale * glm::dot(offset, up) + worldHeight/2) * settings.height / worldHeight;
+    return true;
+}
+
+static bool sameLights( const std::vector<Light> &a, const std::vector<Light> &b ) {
+    if (a.size() != b.size()) { return false; }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].position != b[i].position || a[i].intensity != b[i].intensity) { return false; }
+    }
+    return true;
+}
+
+static MovedBound meshBound( const Mesh &mesh ) {
+    MovedBound bound;
+    bound.center = (mesh.getVertex(0) + mesh.getVertex(1) + mesh.getVertex(2)) / 3.0f;
+    bound.radius = 0;
+    for (int v = 0; v < 3; v++) { bound.radius = glm::max(bound.radius, glm::length(mesh.getVertex(v) - bound.center)); }
+    return bound;
+}
+
+// Whether the segment from a to b passes through the bound
+static bool segmentHits( vec3 a, vec3 b, const MovedBound &bound ) {
+    vec3 segment = b - a;
+    float t = glm::clamp(glm::dot(bound.center - a, segment) / glm::dot(segment, segment), 0.0f, 1.0f);
+    return glm::length(a + t*segment - bound.center) <= bound.radius;
+}
+
+int ReprojectionCache::reproject( const Scene &scene, const RenderSettings &settings, Framebuffer &framebuffer ) {
+    int size = settings.width * settings.height;
+    confidence.assign(size, 0.0f);
+    next.resize(size);
+    if (!valid || settings.width != width || settings.height != height || !sameLights(scene.lights, previous.lights) ||
+        scene.spheres.size() != previous.spheres.size() || scene.meshes.size() != previous.meshes.size()) {
+        width = settings.width;
+        height = settings.height;
+        return 0;
+    }
+    
+    // Per frame scratch lives in the thread's arena until the frame is reprojected
+    Arena &arena = threadArena();
+    ArenaScope scope(arena);
+    
+    // Objects that moved since the last frame, and where they were and are now
+    ArenaVector<bool> moved(scene.numObjects(), false, ArenaAllocator<bool>(arena));
+    ArenaVector<MovedBound> bounds((ArenaAllocator<MovedBound>(arena)));
+    for (size_t i = 0; i < scene.spheres.size(); i++) {
+        const Sphere &now = scene.spheres[i];
+        const Sphere &before = previous.spheres[i];
+        if (now.getPosition() == before.getPosition() && now.getRadius() == before.getRadius()) { continue; }
+        moved[i] = true;
+        MovedBound was = { before.getPosition(), before.getRadius() };
+        MovedBound is = { now.getPosition(), now.getRadius() };
+        bounds.push_back(was);
+        bounds.push_back(is);
+    }
+    for (size_t i = 0; i < scene.meshes.size(); i++) {
+        const Mesh &now = scene.meshes[i];
+        const Mesh &before = previous.meshes[i];
+        if (now.getVertex(0) == before.getVertex(0) && now.getVertex(1) == before.getVertex(1) && now.getVertex(2) == before.getVertex(2)) { continue; }
+        moved[scene.spheres.size() + i] = true;
+        bounds.push_back(meshBound(before));
+        bounds.push_back(meshBound(now));
+    }
+    
+    // Splat every cached hit, nearest first; untrusted hits still hide what is behind them
+    float* nearest = arena.allocateArray<float>(size);
+    int* source = arena.allocateArray<int>(size);
+    std::fill(nearest, nearest + size, std::numeric_limits<float>::infinity());
+    std::fill(source, source + size, -1);
+    for (size_t i = 0; i < pixels.size(); i++) {
+        if (pixels[i].object < 0) { continue; }
+        float px, py;
+        if (!project(scene.cam, settings, pixels[i].position, px, py)) { continue; }
+        int x = floorf(px);
+        int y = floorf(py);
+        if (x < 0 || y < 0 || x >= width || y >= height) { continue; }
+        float distance = glm::length(pixels[i].position - scene.cam.position);
+        if (distance < nearest[y*width + x]) {
+            nearest[y*width + x] = distance;
+            source[y*width + x] = i;
+        }
+    }
+    
+    int reusedPixels = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int index = y*width + x;
+            if (source[index] < 0) { continue; }
+            const CachedPixel &cached = pixels[source[index]];
+            if (moved[cached.object] || cached.age >= maxReuseAge) { continue; }
+            
+            // Object edges are traced again: the splat came from somewhere else in
+            // the old pixel, which matters most where the colour changes sharply
+            float closest = nearest[index];
+            bool edge = false;
+            for (int j = glm::max(y - 1, 0); j <= glm::min(y + 1, height - 1); j++) {
+                for (int i = glm::max(x - 1, 0); i <= glm::min(x + 1, width - 1); i++) {
+                    int neighbour = source[j*width + i];
+                    edge = edge || neighbour < 0 || pixels[neighbour].object != cached.object;
+                    closest = glm::min(closest, nearest[j*width + i]);
+                }
+            }
+            if (edge || nearest[index] > closest * neighbourDepthTolerance) { continue; }
+            
+            vec3 before = glm::normalize(cached.position - previous.cam.position);
+            vec3 now = glm::normalize(cached.position - scene.cam.position);
+            float trust = glm::dot(before, now);
+            if (trust < minConfidence) { continue; }
+            
+            if (!bounds.empty()) {
+                bool changed = scene.objectMaterial(cached.object).getReflectance() != vec3(0.0f);
+                // A moved object may now sit in front of the hit, or have uncovered it
+                for (size_t b = 0; b < bounds.size() && !changed; b++) {
+                    changed = segmentHits(scene.cam.position, cached.position, bounds[b]);
+                }
+                for (size_t l = 0; l < scene.lights.size() && !changed; l++) {
+                    for (size_t b = 0; b < bounds.size() && !changed; b++) {
+                        changed = segmentHits(cached.position, scene.lights[l].position, bounds[b]);
+                    }
+                }
+                if (changed) { continue; }
+            }
+            
+            confidence[index] = glm::max(trust, std::numeric_limits<float>::min());
+            next[index] = cached;
+            next[index].age++;
+            framebuffer.set(x, y, cached.color);
+            reusedPixels++;
+        }
+    }
+    return reusedPixels;
+}
+
+void ReprojectionCache::record( int x, int y, vec3 color, const AOVSample &hit ) {
+    CachedPixel &pixel = next[y*width + x];
+    pixel.color = color;
+    pixel.position = hit.position;
+    pixel.object = hit.object;
+    pixel.age = 0;
+}
+
+void ReprojectionCache::commit( const Scene &scene ) {
+    previous = scene;
+    pixels.swap(next);
+    valid = true;
+}
+
+void ReprojectionCache::confidenceMask( Framebuffer &mask ) const {
+    mask.resize(width, height, 1);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            mask.setValue(x, y, confidence[y*width + x]);
+        }
+    }
+}
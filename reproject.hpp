@@ -0,0 +1,61 @@
+//
+//  reproject.hpp
+//  
+//
+
+#ifndef reproject_hpp
+#define reproject_hpp
+
+#include <vector>
+#include "render.hpp"
+
+// Temporal reprojection between consecutive animation frames
+// Each frame keeps the shaded colour, first hit position and object of every
+// pixel. The next frame projects those hits into its own view. A pixel keeps
+// the nearest hit that lands in it when that hit can be trusted:
+// - its object has not moved and no light has changed
+// - the direction it is seen from turned by at most maxDegrees, so view
+//   dependent highlights and reflections changed little; the cosine of that
+//   turn is the pixel's confidence
+// - it is not shadowed differently: its shadow rays miss every moved object,
+//   and reflective objects are not reused at all once anything moved
+// - its neighbours all hit the same object: at object edges the colour
+//   changes too quickly to reuse a hit from elsewhere in the old pixel
+// - it is not further away than its neighbours' hits, where a background
+//   hit may show through a gap between the splats of a nearer surface
+// - it has been reused fewer than maxReuseAge frames in a row
+// All other pixels are disoccluded or changed and have to be traced
+class ReprojectionCache {
+    struct CachedPixel {
+        vec3 color;
+        vec3 position;
+        int object;
+        int age;
+    };
+    
+    float minConfidence;
+    bool valid;
+    Scene previous;
+    int width;
+    int height;
+    std::vector<CachedPixel> pixels;
+    std::vector<CachedPixel> next;
+    std::vector<float> confidence;
+    
+public:
+    // Larger maxDegrees reuses more pixels at the cost of stale highlights
+    ReprojectionCache(float maxDegrees);
+    // Fills the reusable pixels of the next frame of scene into framebuffer
+    // and returns how many there are
+    int reproject(const Scene &scene, const RenderSettings &settings, Framebuffer &framebuffer);
+    // Whether pixel (x,y) of the next frame was filled by reproject()
+    bool reused(int x, int y) const { return confidence[y*width + x] > 0; }
+    // Records a traced pixel of the next frame; safe to call from several threads for different pixels
+    void record(int x, int y, vec3 color, const AOVSample &hit);
+    // Makes the next frame, rendered from scene, the one to reproject from
+    void commit(const Scene &scene);
+    // Confidence of each pixel of the next frame, 0 where it was traced
+    void confidenceMask(Framebuffer &mask) const;
+};
+
+#endif /* reproject_hpp */
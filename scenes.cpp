@@ -0,0 +1,150 @@
+//
+//  scenes.cpp
+//  
+//
+
+#include <string.h>
+#include <string>
+#include "scenes.hpp"
+#include "render.hpp"
+
+const char* sceneNames[] = { "spheres", "triangles", "lights", "reflections" };
+const int numScenes = 4;
+const char* sizeNames[] = { "small", "medium", "large" };
+const int numSizes = 3;
+
+// Deterministic generator so every version renders exactly the same scenes
+// The state belongs to the scene being built, so scenes can be built on
+// several threads at once
+static float benchRandom( unsigned int &state, float lo, float hi ) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return lo + (hi - lo) * (state >> 8) * (1.0f / 16777216.0f);
+}
+
+static vec3 randomVec( unsigned int &state, vec3 lo, vec3 hi ) {
+    float x = benchRandom(state, lo.x, hi.x);
+    float y = benchRandom(state, lo.y, hi.y);
+    float z = benchRandom(state, lo.z, hi.z);
+    return vec3(x, y, z);
+}
+
+static void addLight( Scene &scene, vec3 position, vec3 intensity ) {
+    Light light = { position, intensity };
+    scene.lights.push_back(light);
+}
+
+static void addSphere( Scene &scene, vec3 position, float radius, vec3 diff, vec3 spec, float p, vec3 ref ) {
+    scene.spheres.push_back(Sphere(position, radius, scene.addMaterial(Material(diff, spec, p, ref))));
+}
+
+static void addTriangle( Scene &scene, vec3 a, vec3 b, vec3 c, vec3 diff, vec3 spec, float p, vec3 ref ) {
+    float verts[9] = { a.x, a.y, a.z, b.x, b.y, b.z, c.x, c.y, c.z };
+    scene.meshes.push_back(Mesh(verts, scene.addMaterial(Material(diff, spec, p, ref))));
+}
+
+// A floor below the scene facing the camera, made of two triangles
+static void addFloor( Scene &scene, float height, vec3 ref ) {
+    addTriangle(scene, vec3(-8,height,-8), vec3(8,height,-8), vec3(8,height,8), vec3(80,80,80), vec3(0.0f), 1, ref);
+    addTriangle(scene, vec3(-8,height,-8), vec3(8,height,8), vec3(-8,height,8), vec3(80,80,80), vec3(0.0f), 1, ref);
+}
+
+int buildScene( Scene &scene, int index, int size ) {
+    unsigned int generator = 1;
+    scene = Scene();
+    // Looking down on a 10x10 region around the origin
+    Camera camera = { vec3(0,5,0), vec3(0,-1,0), 4 };
+    scene.cam = camera;
+    int maxDepth = 2;
+    
+    if (index == 0) {
+        // Many spheres of random size and material
+        int count = 64 << (3 * size);
+        float radius = 0.4f / (1 << size);
+        for (int i = 0; i < count; i++) {
+            addSphere(scene, randomVec(generator, vec3(-4,-6,-4), vec3(4,-1,4)), benchRandom(generator, 0.25f, 1.0f) * radius,
+                      randomVec(generator, vec3(0.0f), vec3(255.0f)), vec3(100,100,100), 50, vec3(benchRandom(generator, 0.0f, 0.5f)));
+        }
+        addLight(scene, vec3(5,5,0), vec3(1,1,1));
+        addLight(scene, vec3(-5,5,5), vec3(0.5,0.5,0.5));
+    } else if (index == 1) {
+        // Soup of small random triangles
+        int count = 128 << (3 * size);
+        float extent = 0.8f / (1 << size);
+        for (int i = 0; i < count; i++) {
+            vec3 center = randomVec(generator, vec3(-4,-6,-4), vec3(4,-1,4));
+            addTriangle(scene, center + randomVec(generator, vec3(-extent), vec3(extent)), center + randomVec(generator, vec3(-extent), vec3(extent)),
+                        center + randomVec(generator, vec3(-extent), vec3(extent)), randomVec(generator, vec3(0.0f), vec3(255.0f)), vec3(0.0f), 1, vec3(0.0f));
+        }
+        addLight(scene, vec3(5,5,0), vec3(1,1,1));
+        addLight(scene, vec3(-5,5,5), vec3(0.5,0.5,0.5));
+    } else if (index == 2) {
+        // A few spheres on a floor lit by many dim lights
+        for (int i = 0; i < 8; i++) {
+            addSphere(scene, vec3(-3.5f + i, -5, 0), 0.45f, randomVec(generator, vec3(50.0f), vec3(255.0f)), vec3(100,100,100), 50, vec3(0.0f));
+        }
+        addFloor(scene, -7, vec3(0.0f));
+        int count = 8 << (3 * size);
+        for (int i = 0; i < count; i++) {
+            addLight(scene, randomVec(generator, vec3(-6,0,-6), vec3(6,5,6)), vec3(4.0f / count));
+        }
+    } else {
+        // Mirror spheres in an open mirror box, traced to a deep bounce count
+        addSphere(scene, vec3(-1.5,-3,0), 1.4, vec3(40,40,40), vec3(100,100,100), 100, vec3(0.9f));
+        addSphere(scene, vec3(1.5,-3,0), 1.4, vec3(40,10,10), vec3(100,100,100), 100, vec3(0.9f));
+        addSphere(scene, vec3(0,-3,2.5), 1.0, vec3(10,40,10), vec3(100,100,100), 100, vec3(0.9f));
+        addFloor(scene, -7, vec3(0.8f));
+        for (int side = -1; side <= 1; side += 2) {
+            float w = 5.0f * side;
+            addTriangle(scene, vec3(w,-7,-5), vec3(w,8,-5), vec3(w,8,5), vec3(20,20,20), vec3(0.0f), 1, vec3(0.8f));
+            addTriangle(scene, vec3(w,-7,-5), vec3(w,8,5), vec3(w,-7,5), vec3(20,20,20), vec3(0.0f), 1, vec3(0.8f));
+            addTriangle(scene, vec3(-5,-7,w), vec3(-5,8,w), vec3(5,8,w), vec3(20,20,20), vec3(0.0f), 1, vec3(0.8f));
+            addTriangle(scene, vec3(-5,-7,w), vec3(5,8,w), vec3(5,-7,w), vec3(20,20,20), vec3(0.0f), 1, vec3(0.8f));
+        }
+        addLight(scene, vec3(2,4,0), vec3(1,1,1));
+        addLight(scene, vec3(-2,4,2), vec3(0.5,0.5,0.5));
+        maxDepth = 4 << (2 * size);
+    }
+    return maxDepth;
+}
+
+void buildDefaultScene( Scene &scene ) {
+    scene = Scene();
+    std::vector<Light> &lights = scene.lights;
+    std::vector<Sphere> &spheres = scene.spheres;
+    
+    lights.resize(2);
+    lights[0].position = vec3(5,5,0);
+    lights[0].intensity = vec3(1,1,1);
+    lights[1].position = vec3(0,5,0);
+    lights[1].intensity = vec3(0.5,0.5,0.5);
+    
+    spheres.push_back(Sphere(vec3(3,0,0), 3, scene.addMaterial(Material(vec3(100,100,100), vec3(100,100,100), 100, vec3(0.6f)))));
+    spheres.push_back(Sphere(vec3(-3,0,0), 2, scene.addMaterial(Material(vec3(200,0,0), vec3(100,100,100), 100, vec3(0.0f)))));
+    
+//    float verts[9] = {10,0,10, 6,0,0, 0,0,6};
+//    scene.meshes.push_back(Mesh(verts, scene.addMaterial(Material(vec3(100,100,100), vec3(0,0,0), 100, vec3(0.0f)))));
+//    float verts2[9] = {2,3,4, 2,3,-4, 1,0,0};
+//    scene.meshes.push_back(Mesh(verts2, scene.addMaterial(Material(vec3(200,0,0), vec3(100,100,100), 100, vec3(0,0.6,0)))));
+}
+
+bool buildNamedScene( Scene &scene, const char* name, int &maxDepth ) {
+    if (strcmp(name, "default") == 0) {
+        buildDefaultScene(scene);
+        maxDepth = RenderSettings().maxDepth;
+        return true;
+    }
+    std::string id = name;
+    size_t dash = id.rfind('-');
+    if (dash == std::string::npos) { return false; }
+    for (int index = 0; index < numScenes; index++) {
+        for (int size = 0; size < numSizes; size++) {
+            if (id.compare(0, dash, sceneNames[index]) == 0 && id.compare(dash + 1, std::string::npos, sizeNames[size]) == 0) {
+                maxDepth = buildScene(scene, index, size);
+                return true;
+            }
+        }
+    }
+    return false;
+}
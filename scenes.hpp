@@ -0,0 +1,27 @@
+//
+//  scenes.hpp
+//  
+//
+
+#ifndef scenes_hpp
+#define scenes_hpp
+
+#include "render.hpp"
+
+// Built in scenes. Each one replaces everything in the scene it is built into
+
+extern const char* sceneNames[];
+extern const int numScenes;
+extern const char* sizeNames[];
+extern const int numSizes;
+
+// The scene raytracer renders by default
+void buildDefaultScene( Scene &scene );
+// Procedural benchmark scene; size is 0 (small), 1 (medium) or 2 (large)
+// Returns the maxDepth the scene is meant to be traced to
+int buildScene( Scene &scene, int index, int size );
+// "default" or a benchmark scene as <scene>-<size>, e.g. spheres-medium, and
+// the maxDepth it is meant to be traced to. Returns false for unknown names
+bool buildNamedScene( Scene &scene, const char* name, int &maxDepth );
+
+#endif /* scenes_hpp */
@@ -0,0 +1,275 @@
+//
+//  server.cpp
+//  
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <iostream>
+#include <string>
+#include <list>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include "server.hpp"
+#include "render.hpp"
+#include "scenes.hpp"
+#include "jobs.hpp"
+#include "deadline.hpp"
+#include "tilepool.hpp"
+
+// Small tiles keep every thread busy until the end of each job
+static const int serverTileSize = 32;
+// A client that sends nothing for this long is disconnected
+static const int idleTimeoutSeconds = 300;
+
+// A built scene and the depth it is meant to be traced to
+struct CachedScene {
+    std::string name;
+    Scene scene;
+    int maxDepth;
+    size_t bytes;
+};
+
+// Built scenes, most recently used first, shared by the client threads
+// Scenes are never changed once built; jobs hold on to the ones they render,
+// so an eviction only drops the cache's reference
+class SceneCache {
+    size_t budget;
+    size_t used;
+    std::list<std::shared_ptr<const CachedScene> > entries;
+    std::mutex mutex;
+    
+public:
+    SceneCache(size_t budgetBytes) : budget(budgetBytes), used(0) {}
+    
+    // The named scene, built on a miss; NULL for unknown names
+    std::shared_ptr<const CachedScene> get(const std::string &name, bool &hit) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (std::list<std::shared_ptr<const CachedScene> >::iterator entry = entries.begin(); entry != entries.end(); ++entry) {
+            if ((*entry)->name == name) {
+                entries.splice(entries.begin(), entries, entry);
+                hit = true;
+                return entries.front();
+            }
+        }
+        hit = false;
+        
+        std::shared_ptr<CachedScene> built(new CachedScene());
+        if (!buildNamedScene(built->scene, name.c_str(), built->maxDepth)) { return NULL; }
+        built->name = name;
+        built->bytes = sizeof(CachedScene) + built->scene.lights.size() * sizeof(Light) +
+                       built->scene.spheres.size() * sizeof(Sphere) + built->scene.meshes.size() * sizeof(Mesh) +
+                       built->scene.materials.size() * sizeof(Material);
+        entries.push_front(built);
+        used += built->bytes;
+        
+        // The new scene is kept even if it alone is over budget
+        while (used > budget && entries.size() > 1) {
+            std::cerr << "Evicting scene " << entries.back()->name << std::endl;
+            used -= entries.back()->bytes;
+            entries.pop_back();
+        }
+        return built;
+    }
+};
+
+static bool sendAll( int fd, const void* data, size_t size ) {
+    const char* bytes = (const char*) data;
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, 0);
+        if (sent <= 0) { return false; }
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool sendLine( int fd, const std::string &line ) {
+    return sendAll(fd, line.c_str(), line.size()) && sendAll(fd, "\n", 1);
+}
+
+static double millisecondsSince( std::chrono::steady_clock::time_point start ) {
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// Runs one job and answers it; returns false if the client went away
+static bool runJob( int fd, const std::string &line, SceneCache &cache, TilePool &pool, int jobNumber, int pngCompression ) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    RenderJob job;
+    std::string error = parseRenderJob(line, job);
+    bool hit = false;
+    std::shared_ptr<const CachedScene> cached;
+    if (job.scene.empty()) { job.scene = "default"; }
+    if (error.empty()) {
+        cached = cache.get(job.scene, hit);
+        if (cached == NULL) { error = "unknown scene " + job.scene; }
+    }
+    if (!error.empty()) {
+        std::cerr << "Job " << jobNumber << ": " << error << std::endl;
+        return sendLine(fd, "error " + error);
+    }
+    double loadMs = millisecondsSince(start);
+    
+    // Other clients may be rendering the cached scene, so a job with its own
+    // camera renders a copy of it
+    std::chrono::steady_clock::time_point renderStart = std::chrono::steady_clock::now();
+    const Scene* scene = &cached->scene;
+    Scene withCamera;
+    if (job.hasCamera) {
+        withCamera = cached->scene;
+        withCamera.cam = job.camera;
+        scene = &withCamera;
+    }
+    RenderSettings settings;
+    settings.width = job.width;
+    settings.height = job.height;
+    settings.samplesPerPixel = job.samplesPerPixel;
+    settings.seed = job.seed;
+    settings.maxDepth = job.maxDepth > 0 ? job.maxDepth : cached->maxDepth;
+    
+    // A deadline counts from when the job arrived, so it includes building the scene
+    Framebuffer framebuffer(job.width, job.height);
+    DeadlineReport achieved;
+    if (job.deadlineMs > 0) {
+        achieved = renderToDeadline(*scene, settings, start + std::chrono::microseconds((long long)(job.deadlineMs * 1000)), framebuffer, pool.numThreads());
+    } else {
+        pool.render(*scene, settings, framebuffer);
+    }
+    double renderMs = millisecondsSince(renderStart);
+    
+    std::chrono::steady_clock::time_point outputStart = std::chrono::steady_clock::now();
+    bool saved = job.output.empty() || saveImage(framebuffer, job.output, pngCompression);
+    double outputMs = millisecondsSince(outputStart);
+    double totalMs = millisecondsSince(start);
+    
+    fprintf(stderr, "Job %d %s %dx%d spp %d: %.3f ms (scene %.3f, render %.3f, output %.3f, cache %s)\n", jobNumber, job.scene.c_str(),
+            job.width, job.height, job.samplesPerPixel, totalMs, loadMs, renderMs, outputMs, hit ? "hit" : "miss");
+    if (!saved) { return sendLine(fd, "error could not write " + job.output); }
+    
+    char status[256];
+    int length = snprintf(status, sizeof(status), "ok total_ms=%.3f scene_ms=%.3f render_ms=%.3f output_ms=%.3f cache=%s",
+                          totalMs, loadMs, renderMs, outputMs, hit ? "hit" : "miss");
+    if (job.deadlineMs > 0) {
+        snprintf(status + length, sizeof(status) - length, " spp=%.2f min_spp=%d max_spp=%d deadline=%s", achieved.averageSamples,
+                 achieved.minSamples, achieved.maxSamples, achieved.missedDeadline ? "missed" : "met");
+    }
+    if (!sendLine(fd, status)) { return false; }
+    if (job.output.empty()) {
+        return sendAll(fd, framebuffer.getData(), (size_t)job.width * job.height * 3 * sizeof(float));
+    }
+    return true;
+}
+
+// What the client threads share
+struct ServerState {
+    SceneCache cache;
+    TilePool pool;
+    int pngCompression;
+    std::atomic<int> jobNumber;
+    std::atomic<bool> running;
+    int listener;
+    std::mutex mutex;
+    std::condition_variable idle;
+    // Sockets of the clients being served, so shutdown can wake them
+    std::set<int> clients;
+    
+    ServerState(size_t cacheBytes, int threads, int compression) : cache(cacheBytes), pool(threads, serverTileSize),
+        pngCompression(compression), jobNumber(0), running(true), listener(-1) {}
+};
+
+// Serves one client for as many jobs as it sends, on a thread of its own
+static void serveClient( ServerState &server, int fd ) {
+    std::string pending;
+    char buffer[4096];
+    bool connected = true;
+    while (connected && server.running) {
+        size_t newline = pending.find('\n');
+        if (newline == std::string::npos) {
+            ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received <= 0) { break; }
+            pending.append(buffer, received);
+            continue;
+        }
+        std::string line = pending.substr(0, newline);
+        pending.erase(0, newline + 1);
+        if (!line.empty() && line[line.size() - 1] == '\r') { line.erase(line.size() - 1); }
+        
+        if (line == "shutdown") {
+            sendLine(fd, "ok");
+            server.running = false;
+            // Wakes the accept() of the main thread
+            shutdown(server.listener, SHUT_RDWR);
+        } else if (line.find_first_not_of(" \t") != std::string::npos) {
+            connected = runJob(fd, line, server.cache, server.pool, ++server.jobNumber, server.pngCompression);
+        }
+    }
+    
+    std::lock_guard<std::mutex> lock(server.mutex);
+    server.clients.erase(fd);
+    close(fd);
+    server.idle.notify_all();
+}
+
+int runServer( const char* socketPath, size_t cacheBytes, int threads, int pngCompression ) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path is too long: " << socketPath << std::endl;
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath);
+    
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath);
+    if (listener == -1 || bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        std::cerr << "Could not listen on " << socketPath << std::endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    
+    // The render threads wait between jobs rather than starting for each one;
+    // jobs from different clients take turns on them
+    ServerState server(cacheBytes, threads, pngCompression);
+    server.listener = listener;
+    std::cerr << "Serving on " << socketPath << " with " << server.pool.numThreads() << " render threads" << std::endl;
+    
+    while (server.running) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd == -1) { continue; }
+        struct timeval timeout = { idleTimeoutSeconds, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        
+        std::lock_guard<std::mutex> lock(server.mutex);
+        if (!server.running) {
+            close(fd);
+            break;
+        }
+        server.clients.insert(fd);
+        std::thread(serveClient, std::ref(server), fd).detach();
+    }
+    
+    // Idle clients are woken; clients in the middle of a job finish it first
+    {
+        std::unique_lock<std::mutex> lock(server.mutex);
+        for (std::set<int>::iterator client = server.clients.begin(); client != server.clients.end(); ++client) {
+            shutdown(*client, SHUT_RD);
+        }
+        server.idle.wait(lock, [&]() { return server.clients.empty(); });
+    }
+    close(listener);
+    unlink(socketPath);
+    return 0;
+}
@@ -0,0 +1,27 @@
+//
+//  server.hpp
+//  
+//
+
+#ifndef server_hpp
+#define server_hpp
+
+#include <stddef.h>
+
+// Long running render server listening on a Unix socket
+// Clients send one job per line in the key=value form described in jobs.hpp;
+// output is optional here
+// Each job is answered by one line: "ok" followed by the job's timings
+// (milliseconds) and cache result, or "error <message>". Jobs without an
+// output file are followed by width*height*3 host order floats on the 0-255
+// scale, bottom row first. The line "shutdown" stops the server
+// Built scenes stay in memory, least recently used first out once they take
+// more than cacheBytes. PNGs are written with pngCompression (see
+// Framebuffer::savePNG)
+// Each job's tiles are shared by threads threads (0 for one per core) that
+// the server keeps for its lifetime; deadline jobs use as many
+// Every client gets a thread of its own and is dropped after five idle
+// minutes; renders from different clients take turns on the render threads
+int runServer( const char* socketPath, size_t cacheBytes, int threads, int pngCompression );
+
+#endif /* server_hpp */
@@ -0,0 +1,182 @@
+//
+//  shading.cpp
+//  
+//
+
+#include <string.h>
+#include "shading.hpp"
+#include "stats.hpp"
+
+// GCC and Clang vector extensions: plain arithmetic on these compiles to SIMD
+// instructions on any target, splitting into narrower registers where the
+// CPU has no 8 wide ones, so no intrinsics or target flags are needed
+typedef float float8 __attribute__((vector_size(32)));
+typedef int int8 __attribute__((vector_size(32)));
+
+// GCC warns that returning these changes the ABI without AVX; every function
+// returning them here is static and inlined, so no ABI is involved
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+static inline float8 splat( float value ) {
+    float8 v = { value, value, value, value, value, value, value, value };
+    return v;
+}
+
+static inline int8 splat( int value ) {
+    int8 v = { value, value, value, value, value, value, value, value };
+    return v;
+}
+
+static inline float8 load( const float* from ) {
+    float8 v;
+    memcpy(&v, from, sizeof(v));
+    return v;
+}
+
+static inline void store( float* to, const float8 &v ) {
+    memcpy(to, &v, sizeof(v));
+}
+
+// Vector casts reinterpret the bits
+static inline float8 select( const int8 &mask, const float8 &a, const float8 &b ) {
+    return (float8)((mask & (int8)a) | (~mask & (int8)b));
+}
+
+static inline float8 vmax( const float8 &a, const float8 &b ) { return select(a > b, a, b); }
+static inline float8 vmin( const float8 &a, const float8 &b ) { return select(a < b, a, b); }
+
+// Small integers to float and back through the float's mantissa
+static const float roundingMagic = 12582912.0f;  // 1.5 * 2^23
+static inline float8 toFloat( const int8 &i ) {
+    return (float8)(i + (int8)splat(roundingMagic)) - roundingMagic;
+}
+static inline int8 roundToInt( const float8 &x ) {
+    return (int8)(x + roundingMagic) - (int8)splat(roundingMagic);
+}
+
+// 1/sqrt(x) from the exponent trick and three Newton steps, to full precision
+static inline float8 rsqrt( const float8 &x ) {
+    float8 y = (float8)(splat(0x5f3759df) - ((int8)x >> 1));
+    for (int i = 0; i < 3; i++) {
+        y = y * (1.5f - 0.5f * x * y * y);
+    }
+    return y;
+}
+
+// log2 of positive normal floats: the exponent plus ln of the mantissa,
+// taken in [sqrt(1/2), sqrt(2)) with the Cephes logf polynomial
+static inline float8 log2v( const float8 &x ) {
+    int8 bits = (int8)x;
+    int8 exponent = ((bits >> 23) & 0xff) - 127;
+    float8 m = (float8)((bits & 0x007fffff) | 0x3f800000);
+    int8 high = m > 1.41421356f;
+    m = select(high, m * 0.5f, m);
+    exponent -= high;
+    
+    float8 t = m - 1.0f;
+    float8 z = t * t;
+    float8 y = splat(7.0376836292e-2f);
+    y = y * t - 1.1514610310e-1f;
+    y = y * t + 1.1676998740e-1f;
+    y = y * t - 1.2420140846e-1f;
+    y = y * t + 1.4249322787e-1f;
+    y = y * t - 1.6668057665e-1f;
+    y = y * t + 2.0000714765e-1f;
+    y = y * t - 2.4999993993e-1f;
+    y = y * t + 3.3333331174e-1f;
+    float8 ln = t + (y * t * z - 0.5f * z);
+    return ln * 1.44269504f + toFloat(exponent);
+}
+
+// 2^x: the integer part goes into the exponent, the rest through the
+// Cephes exp2f polynomial on [-1/2, 1/2]
+static inline float8 exp2v( const float8 &x ) {
+    float8 clamped = vmin(vmax(x, splat(-126.0f)), splat(127.0f));
+    int8 whole = roundToInt(clamped);
+    float8 f = clamped - toFloat(whole);
+    float8 p = splat(1.535336188319500e-4f);
+    p = p * f + 1.339887440266574e-3f;
+    p = p * f + 9.618437357674640e-3f;
+    p = p * f + 5.550332471162809e-2f;
+    p = p * f + 2.402264791363012e-1f;
+    p = p * f + 6.931472028550421e-1f;
+    float8 scale = (float8)((whole + 127) << 23);
+    return (1.0f + p * f) * scale;
+}
+
+// x^e for x >= 0; like std::pow, 0^0 is 1 and 0^e is 0 otherwise
+static inline float8 powv( const float8 &x, const float8 &e ) {
+    float8 result = exp2v(e * log2v(x));
+    float8 atZero = select(e == 0.0f, splat(1.0f), splat(0.0f));
+    return select(x >= 1.17549435e-38f, result, atZero);
+}
+
+void ShadingBatch::allocate( Arena &arena, size_t hits ) {
+    count = hits;
+    size_t padded = (hits + shadingLanes - 1) / shadingLanes * shadingLanes;
+    float** arrays[12] = { &normalX, &normalY, &normalZ, &lightX, &lightY, &lightZ,
+                           &intensityR, &intensityG, &intensityB, &red, &green, &blue };
+    for (int a = 0; a < 12; a++) {
+        *arrays[a] = static_cast<float*>(arena.allocate(padded * sizeof(float), sizeof(float8)));
+    }
+    material = arena.allocateArray<MaterialId>(padded);
+    for (size_t hit = hits; hit < padded; hit++) { material[hit] = 0; }
+}
+
+void MaterialColumns::build( Arena &arena, const Material* materials, size_t materialCount ) {
+    count = materialCount;
+    float** columns[7] = { &diffuseR, &diffuseG, &diffuseB, &specularR, &specularG, &specularB, &exponent };
+    for (int c = 0; c < 7; c++) {
+        *columns[c] = arena.allocateArray<float>(count);
+    }
+    for (size_t m = 0; m < count; m++) {
+        vec3 d = materials[m].getDiffuse();
+        vec3 s = materials[m].getSpecular();
+        diffuseR[m] = d.x;
+        diffuseG[m] = d.y;
+        diffuseB[m] = d.z;
+        specularR[m] = s.x;
+        specularG[m] = s.y;
+        specularB[m] = s.z;
+        exponent[m] = materials[m].getPhongExp();
+    }
+}
+
+// One lane per material id; compilers turn this into a gather where the
+// target has one
+static inline float8 gather( const float* column, const MaterialId* ids ) {
+    float8 v;
+    for (int lane = 0; lane < shadingLanes; lane++) {
+        v[lane] = column[ids[lane]];
+    }
+    return v;
+}
+
+void shadeBatch( const MaterialColumns &materials, ShadingBatch &batch ) {
+    STAT_ADD(STAT_SHADING_CALLS, batch.count);
+    STAT_TIMER(STAT_SHADING);
+    const float* diffuse[3] = { materials.diffuseR, materials.diffuseG, materials.diffuseB };
+    const float* specular[3] = { materials.specularR, materials.specularG, materials.specularB };
+    for (size_t start = 0; start < batch.count; start += shadingLanes) {
+        // Lanes past the end read the padding, which uses material 0
+        const MaterialId* ids = batch.material + start;
+        float8 nx = load(batch.normalX + start), ny = load(batch.normalY + start), nz = load(batch.normalZ + start);
+        float8 lx = load(batch.lightX + start), ly = load(batch.lightY + start), lz = load(batch.lightZ + start);
+        
+        // Diffuse weight, and the specular weight from the half vector
+        float8 lambert = vmax(lx*nx + ly*ny + lz*nz, splat(0.0f));
+        float8 hx = lx + nx, hy = ly + ny, hz = lz + nz;
+        float8 NdotH = (nx*hx + ny*hy + nz*hz) * rsqrt(hx*hx + hy*hy + hz*hz);
+        float8 phong = powv(vmax(NdotH, splat(0.0f)), gather(materials.exponent, ids));
+        
+        float* intensity[3] = { batch.intensityR, batch.intensityG, batch.intensityB };
+        float* output[3] = { batch.red, batch.green, batch.blue };
+        for (int c = 0; c < 3; c++) {
+            float8 light = load(intensity[c] + start);
+            float8 total = gather(diffuse[c], ids) * light * lambert + gather(specular[c], ids) * light * phong;
+            store(output[c] + start, vmin(total, splat(255.0f)));
+        }
+    }
+}
@@ -0,0 +1,57 @@
+//
+//  shading.hpp
+//  
+//
+
+#ifndef shading_hpp
+#define shading_hpp
+
+#include <stddef.h>
+#include "geometry.hpp"
+#include "arena.hpp"
+
+// Hits waiting to be shaded against one light each, stored as one array per
+// component so shadingLanes hits load into one SIMD register per component
+// Integrators that queue hits fill one of these per tile or bounce and shade
+// them all in one call, instead of calling Material::calcShading per hit
+struct ShadingBatch {
+    size_t count;
+    // Unit surface normals
+    float *normalX, *normalY, *normalZ;
+    // Unit directions from the hit towards the light
+    float *lightX, *lightY, *lightZ;
+    float *intensityR, *intensityG, *intensityB;
+    MaterialId *material;
+    // Written by shadeBatch: diffuse plus Phong specular, capped at 255
+    float *red, *green, *blue;
+    
+    // Room for count hits from arena, rounded up to whole SIMD registers and
+    // aligned for them; lives until the arena is rewound. The padding hits
+    // use material 0
+    void allocate(Arena &arena, size_t count);
+};
+
+// The parts of a material table that shading reads, one array per component
+// indexed by MaterialId, so each lane's material is a plain array load
+// Build it once per scene rather than per batch
+struct MaterialColumns {
+    size_t count;
+    float *diffuseR, *diffuseG, *diffuseB;
+    float *specularR, *specularG, *specularB;
+    float *exponent;
+    
+    // Copies the count materials into arrays from arena, which live until
+    // the arena is rewound
+    void build(Arena &arena, const Material* materials, size_t count);
+};
+
+static const int shadingLanes = 8;
+
+// Material::calcShading for every hit of batch, shadingLanes hits at a time
+// materials holds the scene's material table, which batch's MaterialIds
+// index. pow is evaluated as exp2(exponent * log2(x)) with polynomial
+// approximations, so results can differ from the scalar path in the last
+// few bits, which a high Phong exponent magnifies to about 1e-5 of the value
+void shadeBatch( const MaterialColumns &materials, ShadingBatch &batch );
+
+#endif /* shading_hpp */
@@ -0,0 +1,136 @@
+//
+//  stats.cpp
+//  
+//
+
+#include <iostream>
+#include <string.h>
+#include <mutex>
+#include <vector>
+#include "stats.hpp"
+
+const char* statCounterNames[NUM_STAT_COUNTERS] = {
+    "primary_rays", "shadow_rays", "reflection_rays", "sphere_tests", "mesh_tests", "shading_calls",
+    "arena_allocations", "arena_bytes", "arena_heap_bytes", "arena_rewinds"
+};
+const char* statTimerNames[NUM_STAT_TIMERS] = {
+    "ray_generation", "traversal", "shading", "image_output", "render_loop"
+};
+
+thread_local RenderStats* threadStats = NULL;
+bool statTimersEnabled = false;
+
+// Every thread's stats, so they can be merged once rendering ends
+static std::mutex registryMutex;
+static std::vector<RenderStats*> registry;
+
+RenderStats* newThreadStats() {
+    RenderStats* stats = new RenderStats();
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry.push_back(stats);
+    return stats;
+}
+
+// Must not run while other threads are rendering
+void resetStats() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (size_t i = 0; i < registry.size(); i++) {
+        memset(registry[i], 0, sizeof(RenderStats));
+    }
+}
+
+RenderStats mergeStats() {
+    RenderStats total = RenderStats();
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (size_t i = 0; i < registry.size(); i++) {
+        for (int c = 0; c < NUM_STAT_COUNTERS; c++) { total.counters[c] += registry[i]->counters[c]; }
+        for (int t = 0; t < NUM_STAT_TIMERS; t++) {
+            total.nanos[t] += registry[i]->nanos[t];
+            for (int c = 0; c < NUM_PERF_COUNTERS; c++) { total.perf[t][c] += registry[i]->perf[t][c]; }
+        }
+    }
+    return total;
+}
+
+static double perfIPC( RenderStats &stats, StatTimer timer ) {
+    unsigned long long cycles = stats.perf[timer][PERF_CYCLES];
+    return cycles > 0 ? (double)stats.perf[timer][PERF_INSTRUCTIONS] / cycles : 0;
+}
+
+void printStatsTable(FILE *file, RenderStats &stats) {
+#ifdef NO_STATS
+    fprintf(file, "Statistics were compiled out (NO_STATS)\n");
+#endif
+    fprintf(file, "%-20s %16s\n", "counter", "count");
+    for (int c = 0; c < NUM_STAT_COUNTERS; c++) {
+        fprintf(file, "%-20s %16llu\n", statCounterNames[c], stats.counters[c]);
+    }
+    fprintf(file, "%-20s %16s\n", "stage", "seconds");
+    for (int t = 0; t < NUM_STAT_TIMERS; t++) {
+        fprintf(file, "%-20s %16.6f\n", statTimerNames[t], stats.nanos[t] * 1e-9);
+    }
+}
+
+void writeStatsJSON(FILE *file, RenderStats &stats) {
+    fprintf(file, "{\"counters\": {");
+    for (int c = 0; c < NUM_STAT_COUNTERS; c++) {
+        fprintf(file, "%s\"%s\": %llu", c ? ", " : "", statCounterNames[c], stats.counters[c]);
+    }
+    fprintf(file, "}, \"seconds\": {");
+    for (int t = 0; t < NUM_STAT_TIMERS; t++) {
+        fprintf(file, "%s\"%s\": %.9f", t ? ", " : "", statTimerNames[t], stats.nanos[t] * 1e-9);
+    }
+    if (perfEnabled) {
+        fprintf(file, "}, \"perf\": {");
+        bool first = true;
+        for (int t = 0; t < NUM_STAT_TIMERS; t++) {
+            if (!perfCounted((StatTimer)t)) { continue; }
+            fprintf(file, "%s\"%s\": {", first ? "" : ", ", statTimerNames[t]);
+            for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+                if (perfCounterAvailable[c]) {
+                    fprintf(file, "\"%s\": %llu, ", perfCounterNames[c], stats.perf[t][c]);
+                } else {
+                    fprintf(file, "\"%s\": null, ", perfCounterNames[c]);
+                }
+            }
+            fprintf(file, "\"ipc\": %.4f}", perfIPC(stats, (StatTimer)t));
+            first = false;
+        }
+    }
+#ifdef NO_STATS
+    fprintf(file, "}, \"enabled\": false}\n");
+#else
+    fprintf(file, "}, \"enabled\": true}\n");
+#endif
+}
+
+// Misses are divided by all rays cast (primary, shadow and reflection), so each
+// stage's figure is its share of the misses per ray
+void printPerfTable(FILE *file, RenderStats &stats) {
+    unsigned long long rays = stats.counters[STAT_PRIMARY_RAYS] + stats.counters[STAT_SHADOW_RAYS] + stats.counters[STAT_REFLECTION_RAYS];
+    fprintf(file, "%-20s %16s %16s %8s %16s %16s\n", "stage", "cycles", "instructions", "IPC", "llc_misses/ray", "br_misses/ray");
+    for (int t = 0; t < NUM_STAT_TIMERS; t++) {
+        if (!perfCounted((StatTimer)t)) { continue; }
+        fprintf(file, "%-20s", statTimerNames[t]);
+        for (int c = PERF_CYCLES; c <= PERF_INSTRUCTIONS; c++) {
+            if (perfCounterAvailable[c]) {
+                fprintf(file, " %16llu", stats.perf[t][c]);
+            } else {
+                fprintf(file, " %16s", "n/a");
+            }
+        }
+        if (perfCounterAvailable[PERF_CYCLES] && perfCounterAvailable[PERF_INSTRUCTIONS]) {
+            fprintf(file, " %8.3f", perfIPC(stats, (StatTimer)t));
+        } else {
+            fprintf(file, " %8s", "n/a");
+        }
+        for (int c = PERF_LLC_MISSES; c <= PERF_BRANCH_MISSES; c++) {
+            if (perfCounterAvailable[c] && rays > 0) {
+                fprintf(file, " %16.4f", (double)stats.perf[t][c] / rays);
+            } else {
+                fprintf(file, " %16s", "n/a");
+            }
+        }
+        fprintf(file, "\n");
+    }
+}
@@ -0,0 +1,129 @@
+//
+//  stats.hpp
+//  
+//
+
+#ifndef stats_hpp
+#define stats_hpp
+
+#include <stdio.h>
+#include <chrono>
+#include "perf.hpp"
+
+// Render instrumentation: event counters and per stage timers
+// Every thread updates its own copy, and the copies are summed by mergeStats()
+// Building with -DNO_STATS (make STATS=0) compiles all of it out
+
+enum StatCounter {
+    STAT_PRIMARY_RAYS,
+    STAT_SHADOW_RAYS,
+    STAT_REFLECTION_RAYS,
+    STAT_SPHERE_TESTS,
+    STAT_MESH_TESTS,
+    STAT_SHADING_CALLS,
+    // Scratch memory (see arena.hpp): allocations and their bytes, bytes
+    // taken from the heap for arena blocks, and rewinds
+    STAT_ARENA_ALLOCATIONS,
+    STAT_ARENA_BYTES,
+    STAT_ARENA_HEAP_BYTES,
+    STAT_ARENA_REWINDS,
+    NUM_STAT_COUNTERS
+};
+
+enum StatTimer {
+    STAT_RAY_GENERATION,
+    STAT_TRAVERSAL,
+    STAT_SHADING,
+    STAT_IMAGE_OUTPUT,
+    // The whole tile loop, around all of the stages above
+    STAT_RENDER_LOOP,
+    NUM_STAT_TIMERS
+};
+
+extern const char* statCounterNames[NUM_STAT_COUNTERS];
+extern const char* statTimerNames[NUM_STAT_TIMERS];
+
+struct RenderStats {
+    unsigned long long counters[NUM_STAT_COUNTERS];
+    // Thread time spent in each stage, in nanoseconds
+    unsigned long long nanos[NUM_STAT_TIMERS];
+    // Hardware counter deltas over each stage, when perf counting is enabled
+    unsigned long long perf[NUM_STAT_TIMERS][NUM_PERF_COUNTERS];
+};
+
+// The calling thread's stats, created on first use
+// They are heap allocated so they can still be merged after the thread exits
+extern thread_local RenderStats* threadStats;
+RenderStats* newThreadStats();
+
+inline RenderStats& localStats() {
+    if (threadStats == NULL) { threadStats = newThreadStats(); }
+    return *threadStats;
+}
+
+// Stage timers read the clock twice per timed call, which costs far more than
+// the counters, so they only run once enabled (raytracer --stats does this)
+extern bool statTimersEnabled;
+
+// The render loop and image output are always counted once perf counting is
+// on; the per ray stages only with perfStagesEnabled
+inline bool perfCounted( StatTimer timer ) {
+    return perfEnabled && (perfStagesEnabled || timer == STAT_RENDER_LOOP || timer == STAT_IMAGE_OUTPUT);
+}
+
+// Adds the time (and hardware counts) between construction and destruction to a stage
+class ScopedStatTimer {
+    StatTimer timer;
+    std::chrono::steady_clock::time_point start;
+    unsigned long long perfStart[NUM_PERF_COUNTERS];
+    
+public:
+    ScopedStatTimer(StatTimer t) : timer(t) {
+        if (perfCounted(timer)) { readPerfCounters(perfStart); }
+        if (statTimersEnabled) { start = std::chrono::steady_clock::now(); }
+    }
+    ~ScopedStatTimer() {
+        if (statTimersEnabled) {
+            std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+            localStats().nanos[timer] += elapsed.count();
+        }
+        if (perfCounted(timer)) {
+            unsigned long long perfEnd[NUM_PERF_COUNTERS];
+            readPerfCounters(perfEnd);
+            for (int c = 0; c < NUM_PERF_COUNTERS; c++) {
+                localStats().perf[timer][c] += perfEnd[c] - perfStart[c];
+            }
+        }
+    }
+};
+
+void resetStats();
+RenderStats mergeStats();
+void printStatsTable(FILE *file, RenderStats &stats);
+void writeStatsJSON(FILE *file, RenderStats &stats);
+// IPC and misses per ray for each stage with hardware counts
+void printPerfTable(FILE *file, RenderStats &stats);
+
+#define STATS_CONCAT2(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT2(a, b)
+
+#ifndef NO_STATS
+#define STAT_COUNT(counter) (localStats().counters[counter]++)
+#define STAT_ADD(counter, amount) (localStats().counters[counter] += (amount))
+#define STAT_TIMER(timer) ScopedStatTimer STATS_CONCAT(statTimer, __LINE__)(timer)
+#else
+#define STAT_COUNT(counter) ((void)0)
+#define STAT_ADD(counter, amount) ((void)0)
+#define STAT_TIMER(timer) ((void)0)
+#endif
+
+// Sphere and mesh tests made by the calling thread so far; always 0 with NO_STATS
+inline unsigned long long primitiveTests() {
+#ifndef NO_STATS
+    return localStats().counters[STAT_SPHERE_TESTS] + localStats().counters[STAT_MESH_TESTS];
+#else
+    return 0;
+#endif
+}
+
+#endif /* stats_hpp */
@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+#  distributed_loopback.sh
+#
+#
+# Renders an image with a coordinator and two workers on localhost and checks
+# it matches the same render done locally, beauty and an AOV, bit for bit. A
+# client that connects and never sends anything is kept open throughout, so
+# the coordinator must not wait on it
+# Usage: tests/distributed_loopback.sh [raytracer] [port]
+
+RAYTRACER=${1:-./raytracer}
+PORT=${2:-47431}
+WORK=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null; rm -rf "$WORK"' EXIT
+ARGS="--width 96 --height 64 --spp 2 --tile-size 16 --no-png --aov depth --aov-format pfm"
+
+"$RAYTRACER" $ARGS --pfm "$WORK/local.pfm" --aov-prefix "$WORK/local" 2>/dev/null || { echo "FAIL: local render"; exit 1; }
+
+"$RAYTRACER" $ARGS --pfm "$WORK/remote.pfm" --aov-prefix "$WORK/remote" --coordinator $PORT 2>"$WORK/coordinator.log" &
+COORDINATOR=$!
+sleep 0.5
+exec 3<>/dev/tcp/127.0.0.1/$PORT || { echo "FAIL: coordinator is not listening"; exit 1; }
+"$RAYTRACER" --worker 127.0.0.1:$PORT 2>"$WORK/worker1.log" &
+"$RAYTRACER" --worker 127.0.0.1:$PORT 2>"$WORK/worker2.log" &
+
+# Bash cannot wait with a timeout, so a watchdog stops a stuck coordinator
+( sleep 30; kill $COORDINATOR 2>/dev/null ) &
+if ! wait $COORDINATOR; then
+    echo "FAIL: coordinator did not finish"
+    cat "$WORK/coordinator.log"
+    exit 1
+fi
+exec 3>&-
+
+for image in .pfm .depth.pfm; do
+    if ! cmp -s "$WORK/local$image" "$WORK/remote$image"; then
+        echo "FAIL: distributed $image differs from the local render"
+        exit 1
+    fi
+done
+echo "PASS: distributed render matches the local render"
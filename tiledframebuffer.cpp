@@ -0,0 +1,250 @@
+//
+//  tiledframebuffer.cpp
+//  
+//
+
+#include <iostream>
+#include <math.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <vector>
+#include "tiledframebuffer.hpp"
+
+// File layout: one header page followed by the tiles in row major order
+// Every tile slot holds tileSize*tileSize pixels, padded to a page boundary
+// so that a single tile can be mapped on its own
+struct TileFileHeader {
+    char magic[8];
+    int width;
+    int height;
+    int channels;
+    int tileSize;
+};
+
+static const char tileFileMagic[8] = { 'R','T','T','I','L','E','S','1' };
+
+static size_t roundToPage(size_t bytes) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (bytes + page - 1) / page * page;
+}
+
+TiledFramebuffer::TiledFramebuffer() {
+    width = 0;
+    height = 0;
+    channels = 0;
+    tileSize = 0;
+    tilesX = 0;
+    tilesY = 0;
+    fd = -1;
+    headerBytes = 0;
+    tileBytes = 0;
+}
+
+TiledFramebuffer::~TiledFramebuffer() {
+    close();
+}
+
+bool TiledFramebuffer::create(const char *filename, int w, int h, int c, int size) {
+    close();
+    fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { return false; }
+    
+    width = w;
+    height = h;
+    channels = c;
+    tileSize = size;
+    tilesX = (w + size - 1) / size;
+    tilesY = (h + size - 1) / size;
+    headerBytes = roundToPage(sizeof(TileFileHeader));
+    tileBytes = roundToPage((size_t)size * size * c * sizeof(float));
+    
+    TileFileHeader header;
+    memcpy(header.magic, tileFileMagic, sizeof(header.magic));
+    header.width = w;
+    header.height = h;
+    header.channels = c;
+    header.tileSize = size;
+    
+    // The file is sized up front; untouched tiles stay sparse on disk
+    off_t fileBytes = headerBytes + tileBytes * tilesX * tilesY;
+    if (ftruncate(fd, fileBytes) != 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool TiledFramebuffer::open(const char *filename) {
+    close();
+    fd = ::open(filename, O_RDWR);
+    if (fd < 0) { return false; }
+    
+    TileFileHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, tileFileMagic, sizeof(header.magic)) != 0) {
+        close();
+        return false;
+    }
+    
+    width = header.width;
+    height = header.height;
+    channels = header.channels;
+    tileSize = header.tileSize;
+    tilesX = (width + tileSize - 1) / tileSize;
+    tilesY = (height + tileSize - 1) / tileSize;
+    headerBytes = roundToPage(sizeof(TileFileHeader));
+    tileBytes = roundToPage((size_t)tileSize * tileSize * channels * sizeof(float));
+    return true;
+}
+
+void TiledFramebuffer::close() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+}
+
+int TiledFramebuffer::getWidth() {
+    return width;
+}
+
+int TiledFramebuffer::getHeight() {
+    return height;
+}
+
+int TiledFramebuffer::getTileSize() {
+    return tileSize;
+}
+
+int TiledFramebuffer::getTilesX() {
+    return tilesX;
+}
+
+int TiledFramebuffer::getTilesY() {
+    return tilesY;
+}
+
+size_t TiledFramebuffer::tileOffset(int tx, int ty) {
+    return headerBytes + tileBytes * ((size_t)ty * tilesX + tx);
+}
+
+// Copy a finished tile into its slot; the tile may be smaller than tileSize at the image edges
+bool TiledFramebuffer::writeTile(int tx, int ty, Framebuffer &tile) {
+    void* mapped = mmap(NULL, tileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, tileOffset(tx, ty));
+    if (mapped == MAP_FAILED) { return false; }
+    
+    float* slot = (float*) mapped;
+    for (int y = 0; y < tile.getHeight(); y++) {
+        for (int x = 0; x < tile.getWidth(); x++) {
+            vec3 c = tile.get(x, y);
+            float* pixel = &slot[(y*tileSize + x) * channels];
+            pixel[0] = c.x;
+            if (channels == 3) {
+                pixel[1] = c.y;
+                pixel[2] = c.z;
+            }
+        }
+    }
+    
+    return munmap(mapped, tileBytes) == 0;
+}
+
+bool TiledFramebuffer::readTile(int tx, int ty, Framebuffer &tile) {
+    void* mapped = mmap(NULL, tileBytes, PROT_READ, MAP_SHARED, fd, tileOffset(tx, ty));
+    if (mapped == MAP_FAILED) { return false; }
+    
+    int w = glm::min(tileSize, width - tx*tileSize);
+    int h = glm::min(tileSize, height - ty*tileSize);
+    tile.resize(w, h, channels);
+    
+    float* slot = (float*) mapped;
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            float* pixel = &slot[(y*tileSize + x) * channels];
+            if (channels == 3) {
+                tile.set(x, y, vec3(pixel[0], pixel[1], pixel[2]));
+            } else {
+                tile.setValue(x, y, pixel[0]);
+            }
+        }
+    }
+    
+    munmap(mapped, tileBytes);
+    return true;
+}
+
+// Flush written tiles to disk, so a checkpoint never records a tile that could be lost
+bool TiledFramebuffer::sync() {
+    return fsync(fd) == 0;
+}
+
+// Stream the image into a PFM one band of tiles at a time, bottom row first
+bool TiledFramebuffer::exportPFM(const char *filename, float scale) {
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) { return false; }
+    
+    bool written = fprintf(file, "%s\n%d %d\n-1.0\n", channels == 3 ? "PF" : "Pf", width, height) > 0;
+    std::vector<float> line(width * channels);
+    for (int ty = 0; ty < tilesY && written; ty++) {
+        size_t bandBytes = tileBytes * tilesX;
+        void* mapped = mmap(NULL, bandBytes, PROT_READ, MAP_SHARED, fd, tileOffset(0, ty));
+        if (mapped == MAP_FAILED) {
+            fclose(file);
+            return false;
+        }
+        
+        int rows = glm::min(tileSize, height - ty*tileSize);
+        for (int y = 0; y < rows; y++) {
+            for (int x = 0; x < width; x++) {
+                float* slot = (float*) ((char*) mapped + tileBytes * (x / tileSize));
+                float* pixel = &slot[(y*tileSize + x % tileSize) * channels];
+                for (int c = 0; c < channels; c++) {
+                    line[x*channels + c] = pixel[c] * scale;
+                }
+            }
+            written = written && fwrite(&line[0], sizeof(float), line.size(), file) == line.size();
+        }
+        munmap(mapped, bandBytes);
+    }
+    
+    // A full disk shows up as a short write or a failed flush on close
+    return fclose(file) == 0 && written;
+}
+
+// Stream a tone mapped 8-bit binary PPM, top row first
+// Uses the same tone mapping as Framebuffer::savePNG
+bool TiledFramebuffer::exportPPM(const char *filename, float exposure) {
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) { return false; }
+    
+    float scale = powf(2.0f, exposure);
+    bool written = fprintf(file, "P6\n%d %d\n255\n", width, height) > 0;
+    std::vector<unsigned char> line(width * 3);
+    for (int ty = tilesY - 1; ty >= 0 && written; ty--) {
+        size_t bandBytes = tileBytes * tilesX;
+        void* mapped = mmap(NULL, bandBytes, PROT_READ, MAP_SHARED, fd, tileOffset(0, ty));
+        if (mapped == MAP_FAILED) {
+            fclose(file);
+            return false;
+        }
+        
+        int rows = glm::min(tileSize, height - ty*tileSize);
+        for (int y = rows - 1; y >= 0; y--) {
+            for (int x = 0; x < width; x++) {
+                float* slot = (float*) ((char*) mapped + tileBytes * (x / tileSize));
+                float* pixel = &slot[(y*tileSize + x % tileSize) * channels];
+                vec3 c = channels == 3 ? vec3(pixel[0], pixel[1], pixel[2]) : vec3(pixel[0]);
+                c = glm::min( c * scale, vec3(255,255,255) );
+                line[x*3+0] = c.x;
+                line[x*3+1] = c.y;
+                line[x*3+2] = c.z;
+            }
+            written = written && fwrite(&line[0], 1, line.size(), file) == line.size();
+        }
+        munmap(mapped, bandBytes);
+    }
+    
+    // A full disk shows up as a short write or a failed flush on close
+    return fclose(file) == 0 && written;
+}
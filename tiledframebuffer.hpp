@@ -0,0 +1,47 @@
+//
+//  tiledframebuffer.hpp
+//  
+//
+
+#ifndef tiledframebuffer_hpp
+#define tiledframebuffer_hpp
+
+#include <stdio.h>
+#include <stddef.h>
+#include "framebuffer.hpp"
+
+// Framebuffer stored out of core in a file of fixed size tiles
+// Each tile is memory mapped only while it is being written or exported,
+// so memory use is bounded by the tiles in flight rather than the image size
+class TiledFramebuffer {
+    int width;
+    int height;
+    int channels;
+    int tileSize;
+    int tilesX;
+    int tilesY;
+    int fd;
+    size_t headerBytes;
+    size_t tileBytes;
+    
+    size_t tileOffset(int tx, int ty);
+    
+public:
+    TiledFramebuffer();
+    ~TiledFramebuffer();
+    bool create(const char *filename, int w, int h, int c, int size);
+    bool open(const char *filename);
+    void close();
+    int getWidth();
+    int getHeight();
+    int getTileSize();
+    int getTilesX();
+    int getTilesY();
+    bool writeTile(int tx, int ty, Framebuffer &tile);
+    bool readTile(int tx, int ty, Framebuffer &tile);
+    bool sync();
+    bool exportPFM(const char *filename, float scale = 1.0f);
+    bool exportPPM(const char *filename, float exposure);
+};
+
+#endif /* tiledframebuffer_hpp */
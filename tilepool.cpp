@@ -0,0 +1,68 @@
+//
+//  tilepool.cpp
+//  
+//
+
+#include <algorithm>
+#include "tilepool.hpp"
+#include "trace.hpp"
+
+TilePool::TilePool(int count, int size) : scene(NULL), settings(NULL), framebuffer(NULL), tileSize(size), tilesX(0), numTiles(0), nextTile(0), generation(0), busy(0), stopping(false) {
+    if (count <= 0) { count = std::max(1u, std::thread::hardware_concurrency()); }
+    for (int i = 0; i < count; i++) {
+        threads.push_back(std::thread(&TilePool::run, this));
+    }
+}
+
+TilePool::~TilePool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    started.notify_all();
+    for (size_t i = 0; i < threads.size(); i++) { threads[i].join(); }
+}
+
+void TilePool::run() {
+    if (traceEnabled) { setTraceThreadName("render"); }
+    int seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            started.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping) { return; }
+            seen = generation;
+        }
+        
+        int width = settings->width;
+        float* data = framebuffer->getData();
+        for (int index = nextTile++; index < numTiles; index = nextTile++) {
+            int tx = index % tilesX;
+            int ty = index / tilesX;
+            int x0 = tx*tileSize;
+            int y0 = ty*tileSize;
+            int w = std::min(tileSize, width - x0);
+            int h = std::min(tileSize, settings->height - y0);
+            TraceScope trace("tile", tx, ty);
+            renderPixels(*scene, *settings, x0, y0, w, h, data + ((size_t)y0*width + x0)*3, (size_t)width*3);
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy == 0) { finished.notify_all(); }
+    }
+}
+
+void TilePool::render(const Scene &imageScene, const RenderSettings &imageSettings, Framebuffer &target) {
+    std::lock_guard<std::mutex> turn(renderMutex);
+    std::unique_lock<std::mutex> lock(mutex);
+    scene = &imageScene;
+    settings = &imageSettings;
+    framebuffer = &target;
+    tilesX = (imageSettings.width + tileSize - 1) / tileSize;
+    numTiles = tilesX * ((imageSettings.height + tileSize - 1) / tileSize);
+    nextTile = 0;
+    busy = threads.size();
+    generation++;
+    started.notify_all();
+    finished.wait(lock, [&]() { return busy == 0; });
+}
@@ -0,0 +1,50 @@
+//
+//  tilepool.hpp
+//  
+//
+
+#ifndef tilepool_hpp
+#define tilepool_hpp
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "render.hpp"
+
+// Threads that render the tiles of one image at a time, straight into its
+// framebuffer. The threads live as long as the pool, so a render only wakes
+// them; the scene and settings may change between renders
+class TilePool {
+    std::vector<std::thread> threads;
+    // Held for a whole render, so renders from several threads take turns
+    std::mutex renderMutex;
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    const Scene* scene;
+    const RenderSettings* settings;
+    Framebuffer* framebuffer;
+    int tileSize;
+    int tilesX;
+    int numTiles;
+    std::atomic<int> nextTile;
+    int generation;
+    int busy;
+    bool stopping;
+    
+    void run();
+
+public:
+    // count threads (0 for one per core) sharing tileSize pixel tiles
+    TilePool(int count, int tileSize);
+    ~TilePool();
+    
+    int numThreads() const { return threads.size(); }
+    // Returns once every tile of the image is done; may be called from
+    // several threads, which then render one after another
+    void render(const Scene &scene, const RenderSettings &settings, Framebuffer &target);
+};
+
+#endif /* tilepool_hpp */
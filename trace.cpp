@@ -0,0 +1,118 @@
+//
+//  trace.cpp
+//  
+//
+
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+#include "trace.hpp"
+
+bool traceEnabled = false;
+static std::chrono::steady_clock::time_point traceStart;
+
+// Events are stored in fixed size chunks so appending never moves earlier events
+static const int TRACE_CHUNK_EVENTS = 4096;
+
+struct TraceChunk {
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+    int count;
+    TraceChunk* next;
+};
+
+// Only the owning thread writes to a buffer. Buffers are pushed onto a list with
+// compare and swap when a thread records its first event, and are never freed,
+// so they can be written out after their thread has exited
+struct TraceBuffer {
+    int thread;
+    const char* name;
+    TraceChunk* first;
+    TraceChunk* last;
+    TraceBuffer* next;
+};
+
+static std::atomic<TraceBuffer*> traceBuffers(NULL);
+static std::atomic<int> traceThreads(0);
+static thread_local TraceBuffer* threadTrace = NULL;
+
+static TraceBuffer& localTrace() {
+    if (threadTrace == NULL) {
+        TraceBuffer* buffer = new TraceBuffer();
+        buffer->thread = traceThreads++;
+        buffer->name = NULL;
+        buffer->first = buffer->last = new TraceChunk();
+        buffer->first->count = 0;
+        buffer->first->next = NULL;
+        buffer->next = traceBuffers.load();
+        while (!traceBuffers.compare_exchange_weak(buffer->next, buffer)) {}
+        threadTrace = buffer;
+    }
+    return *threadTrace;
+}
+
+void startTrace() {
+    traceStart = std::chrono::steady_clock::now();
+    traceEnabled = true;
+}
+
+long long traceClock() {
+    std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - traceStart;
+    return elapsed.count();
+}
+
+void recordTraceEvent( const char* name, long long start, long long duration, int x, int y ) {
+    TraceBuffer &buffer = localTrace();
+    if (buffer.last->count == TRACE_CHUNK_EVENTS) {
+        TraceChunk* chunk = new TraceChunk();
+        chunk->count = 0;
+        chunk->next = NULL;
+        buffer.last->next = chunk;
+        buffer.last = chunk;
+    }
+    TraceEvent &event = buffer.last->events[buffer.last->count++];
+    event.name = name;
+    event.start = start;
+    event.duration = duration;
+    event.x = x;
+    event.y = y;
+}
+
+void setTraceThreadName( const char* name ) {
+    localTrace().name = name;
+}
+
+bool writeTrace( const char* filename ) {
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) { return false; }
+    
+    // The list is newest first; write threads in the order they started
+    std::vector<TraceBuffer*> buffers;
+    for (TraceBuffer* buffer = traceBuffers.load(); buffer != NULL; buffer = buffer->next) {
+        buffers.insert(buffers.begin(), buffer);
+    }
+    
+    // Chrome trace timestamps and durations are in microseconds
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"raytracer\"}}");
+    for (size_t i = 0; i < buffers.size(); i++) {
+        TraceBuffer* buffer = buffers[i];
+        if (buffer->name != NULL) {
+            fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}", buffer->thread, buffer->name);
+        }
+        for (TraceChunk* chunk = buffer->first; chunk != NULL; chunk = chunk->next) {
+            for (int e = 0; e < chunk->count; e++) {
+                TraceEvent &event = chunk->events[e];
+                fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                        event.name, buffer->thread, event.start * 1e-3, event.duration * 1e-3);
+                if (event.x >= 0) {
+                    fprintf(file, ", \"args\": {\"x\": %d, \"y\": %d}", event.x, event.y);
+                }
+                fprintf(file, "}");
+            }
+        }
+    }
+    fprintf(file, "\n]}\n");
+    
+    bool success = !ferror(file);
+    return fclose(file) == 0 && success;
+}
@@ -0,0 +1,54 @@
+//
+//  trace.hpp
+//  
+//
+
+#ifndef trace_hpp
+#define trace_hpp
+
+#include <chrono>
+
+// Timeline of what each thread was doing, written in the Chrome trace event
+// format so it can be opened in Perfetto (ui.perfetto.dev) or chrome://tracing
+// Every thread appends to its own buffer, so recording never takes a lock
+
+struct TraceEvent {
+    const char* name;
+    // Nanoseconds since the trace was started
+    long long start;
+    long long duration;
+    // Tile coordinates, or -1 for events that are not about a tile
+    int x, y;
+};
+
+// Recording is off unless startTrace() was called (raytracer --trace)
+extern bool traceEnabled;
+
+void startTrace();
+long long traceClock();
+void recordTraceEvent( const char* name, long long start, long long duration, int x = -1, int y = -1 );
+// Names the calling thread in the timeline
+void setTraceThreadName( const char* name );
+// Must not run while other threads are recording
+bool writeTrace( const char* filename );
+
+// Records the time between construction and destruction as one event
+class TraceScope {
+    const char* name;
+    long long start;
+    int x, y;
+    
+public:
+    TraceScope(const char* n, int tx = -1, int ty = -1) : name(n), start(0), x(tx), y(ty) {
+        if (traceEnabled) { start = traceClock(); }
+    }
+    ~TraceScope() {
+        if (traceEnabled) { recordTraceEvent(name, start, traceClock() - start, x, y); }
+    }
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif /* trace_hpp */
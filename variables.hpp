@@ -1,26 +0,0 @@
-//
-//  variables.hpp
-//  
-//
-//  Created by Brendan Martin on 7/8/20.
-//
-
-#ifndef variables_hpp
-#define variables_hpp
-
-#include <stdio.h>
-
-//typedef glm::mat3 mat3;
-//typedef glm::mat4 mat4;
-//typedef glm::vec3 vec3;
-//typedef glm::vec4 vec4;
-//
-// screenHeight and screenWidth are expressed in pixels
-//float screenHeight = 300;
-//float screenWidth = 300;
-//
-//vec3 lightPosition[10];
-//vec3 lightIntensity[10];
-//int lightsUsed;
-
-#endif /* variables_hpp */